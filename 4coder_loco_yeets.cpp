@@ -8,6 +8,7 @@
 // 
 // == IMPLEMENTATION ==
 // @include "4coder_loco_yeets.cpp" in your custom layer. 
+// Keep 4coder_loco_yeets_data.cpp next to it, it is included from there.
 //
 // > loco_render_buffer(Application_Links *app, View_ID view_id, Face_ID face_id, Buffer_ID buffer, Text_Layout_ID text_layout_id, Rect_f32 rect, Frame_Info frame_info)
 // Call this is your custom layer's "render" hook.
@@ -15,8 +16,24 @@
 // > loco_on_buffer_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
 // Call this in your custom layer's "on buffer edit" hook.
 //
-// > loco_yeet_on_buffer_end(Application_Links *app, Buffer_ID buffer_id)
+// > loco_on_buffer_begin(Application_Links *app, Buffer_ID buffer_id)
+// Call this in your custom layer's "begin buffer" hook.
+//
+// > loco_on_buffer_end(Application_Links *app, Buffer_ID buffer_id)
 // Call this in your custom layer's "on buffer end" hook.
+// Yeets from a file that is closed stay in the sheet with the text they had, and are
+// linked up again when the file is opened.
+//
+// > loco_tick(Application_Links *app, Frame_Info frame_info)
+// Call this in your custom layer's "tick" hook.
+//
+// > loco_on_startup(Application_Links *app)
+// Call this at the end of your custom layer's "startup" hook, it restores the yeet sheet of
+// the last session.
+//
+// > loco_on_exit(Application_Links *app)
+// Call this before 4coder exits, e.g. in your "try exit" handler, to save the session and
+// any snapshots changed since the last tick.
 //
 // == COMMANDS ==
 // The main command you will want to bind to a key is the yeet range command:
@@ -27,64 +44,374 @@
 // > loco_yeet_surrounding_function
 // Selects the surrounding function then yeets it.
 //
+// > loco_yeet_outline
+// Yeets every top level function and struct in the current buffer into the yeet sheet at once.
+//
 // > loco_yeet_tag
 // Queries user for a string then searches all open buffers for that string
-// as a comment tag (i.e. "// @tag") and yeets the scope it precedes.
+// as a comment tag (i.e. "// @tag", or "@tag" inside a block or doc comment)
+// and yeets the scope it precedes. A comment can hold several tags.
 // 
 // > loco_yeet_clear
-// Clears all current yeets.
+// Clears all yeets in the current sheet.
 //
 // > loco_yeet_reset_all
-// Clears all yeets in all slots, also remove the markers from the original buffers.
+// Clears all yeets in all sheets and snapshots, also remove the markers from the original buffers.
 //
 // > loco_yeet_remove_marker_pair
 // Removes a single 'yeet', whatever one the cursor is currently inside.
 //
-// > loco_save_snapshot_1
-// > loco_save_snapshot_2
-// > loco_save_snapshot_3
-// Saves the current collection of yeets to a slot.
- // Note that these do not persist if you close the editor.
-// 
+// > loco_yeet_undo
+// > loco_yeet_redo
+// Undo and redo the yeet commands, remove, clear and snapshot loads. A step only costs the
+// blocks that changed, and the history drops its oldest steps once it holds more than
+// loco_yeet_history_max_bytes. Each step prints how much the history holds.
+//
+// > loco_yeet_reanchor
+// Finds blocks whose markers were lost, in the current buffer or every buffer in the yeet sheet.
+// This also happens by itself in loco_tick when an edit swallows whole blocks, like a file
+// being reloaded after it changed on disk. Blocks are found by a fingerprint of their text
+// and a few lines around it, or by their first and last lines if the block itself changed.
+//
+// > loco_save_yeet_snapshot_as
+// Queries for a name and saves the current collection of yeets as a snapshot with that name.
+// There can be any number of snapshots. Saving is cheap, snapshots share the pair
+// records they have in common with each other and with the yeet sheet.
+// Snapshots are written to "yeet_snapshots.bin" in the 4coder directory and read back
+// the first time a snapshot is used. Yeets from files that aren't open stay in the
+// snapshot and come back once the file is opened.
+//
+// > loco_switch_yeet_snapshot
+// Lists the snapshots and loads the chosen one into the yeet buffer.
+// Blocks the sheet already shows are kept in place, only the ones that differ are
+// removed or inserted.
+//
+// > loco_delete_yeet_snapshot
+// Lists the snapshots and deletes the chosen one.
+//
+// > loco_yeet_diff_snapshots
+// Asks for two snapshots, the yeet sheet can be picked as one, and lists the blocks that were
+// added, removed or moved between them in the "*yeet diff*" buffer.
+//
+// > loco_yeet_merge_snapshots
+// Asks for a snapshot, or the yeet sheet, and a snapshot to merge it into. Blocks the second
+// one doesn't have yet are added at its end. Blocks count as the same if they are copies of
+// one yeet, or come from the same file with the same text.
+//
+// > loco_save_yeet_snapshot_1
+// > loco_save_yeet_snapshot_2
+// > loco_save_yeet_snapshot_3
 // > loco_load_yeet_snapshot_1
 // > loco_load_yeet_snapshot_2
 // > loco_load_yeet_snapshot_3
-// Loads a yeet snapshot into the yeet buffer.
+// Quick save and load for the snapshots named "1", "2" and "3".
 //
 // > loco_jump_between_yeet
 // Will attempt to jump to the corresponding location in the linked buffer.
 //
+// > loco_yeet_new_sheet
+// > loco_yeet_switch_sheet
+// There can be any number of yeet sheets, "*yeet*" and one "*yeet:NAME*" buffer per name.
+// Commands act on the current sheet, the one that was last in the active view. An edit is
+// only sent to the sheets that hold blocks from the edited buffer, so more sheets don't
+// make typing slower. Undo history is kept per sheet, the session only journals "*yeet*".
+// When the same text is yeeted more than once, an edit to any copy or to the source reaches
+// every copy. Edits are collected per buffer and sent on once per frame, so a paste or a
+// macro that makes hundreds of edits costs one write per block, of only the changed part.
+// Text typed right before or after a block joins the block. Replacing a whole block copies
+// all of it, but deleting a block's text in a sheet, or replacing several blocks with one
+// edit, isn't written back to the sources, the blocks are marked diverged instead. In a
+// source, such edits and reloads make the blocks be found again. Editing several blocks
+// at once with multiple cursors or a macro syncs each of them as usual.
+//
+// > loco_yeet_new_portal_sheet
+// A portal sheet made with this holds a one line "[portal]" stand-in per block instead
+// of a copy, so yeeting a large range copies nothing. Jumping from a stand-in opens the
+// source at that spot with the text outside the block dimmed, and edits there are plain
+// source edits. The portal closes when the cursor leaves the block.
+//
+// > loco_yeet_toggle_read_only_sheet
+// A read-only sheet made with this is a one way mirror. Typing in a source only notes
+// the source. Once per frame the blocks near the edits are marked stale, and only the
+// stale blocks that a yeet view shows are copied again.
+//
+// > loco_yeet_verify
+// Compares every yeet block with its source by hash, after the block's edits were sent on.
+// Blocks that differ get "diverged" in their source comment. A block is only hashed again
+// when an edit touched it or its source since the last verify, so checking thousands of
+// unchanged blocks is a pass over the pairs. Set loco_yeet_verify_repair to true to copy
+// diverged blocks from their source instead.
+//
 // == CONFIG ==
 // There are currently a few global variables below, their variable names are self-explanatory.
 //
+// Set loco_yeet_lazy_snapshot_load to true to load snapshots with a placeholder for each
+// block. A block's text is copied in from its source when it scrolls into a yeet view or
+// the cursor enters it, so loading a huge snapshot costs about the same as a small one.
+//
+// Source edits to blocks that no yeet view shows only mark them stale. They are copied
+// when they scroll into view or their sheet is focused, and on frames without edits up to
+// loco_yeet_idle_drain_count of them are copied, so typing only pays for what is on screen.
+//
+// Blocks bigger than loco_yeet_sync_chunk_size are copied a chunk at a time, for at most
+// loco_yeet_sync_budget_us per frame, and their source comment shows how far the copy got.
+//
+// The yeet sheet is journaled to "yeet_session.bin" every loco_yeet_session_autosave_ms.
+// A save only appends the part of the sheet that changed. On startup the sheet comes back
+// with a placeholder per block that is filled in like a lazy snapshot load.
+//
+// tests/loco_yeets_data_check.cpp round-trips the snapshot file and the session journal and
+// checks the pair table reference counts, without the 4coder headers:
+// c++ -std=c++11 tests/loco_yeets_data_check.cpp -o loco_yeets_data_check && ./loco_yeets_data_check
+//
 */
 CUSTOM_ID(attachment, loco_marker_handle);
 CUSTOM_ID(attachment, loco_marker_pair_handle);
+CUSTOM_ID(attachment, loco_nest_index_handle);
+CUSTOM_ID(attachment, loco_view_visible_range_handle);
+CUSTOM_ID(attachment, loco_anchor_state_handle);
+CUSTOM_ID(attachment, loco_sheet_handle);
+CUSTOM_ID(attachment, loco_source_sheets_handle);
+CUSTOM_ID(attachment, loco_sync_guard_handle);
+CUSTOM_ID(attachment, loco_view_portal_handle);
+CUSTOM_ID(attachment, loco_pending_sync_handle);
+CUSTOM_ID(attachment, loco_verify_dirty_handle);
+CUSTOM_ID(attachment, loco_line_table_handle);
+
+#include "4coder_loco_yeets_data.cpp"
 
 //--TYPES
 
 // @yeettype
-struct Loco_Marker_Pair
+enum Loco_Marker_Pair_Flags
+{
+    // The source file isn't open. The pair only has its file, last known range and
+    // fingerprint, its yeet block keeps the text it had, and it is bound to a buffer
+    // again when the file is opened.
+    Loco_Pair_Flag_Dormant = (1 << 0),
+    // The yeet sheet only holds a placeholder for the block. The source text is copied
+    // in once the block scrolls into a yeet view or the cursor enters it.
+    Loco_Pair_Flag_Lazy = (1 << 1),
+    // Set with Lazy. The block still holds text, but its source changed while no view showed
+    // it. It's copied again like a placeholder, when the sheet is focused, or by the idle drain.
+    Loco_Pair_Flag_Stale = (1 << 2),
+    // Set with Lazy. The block is too big to copy in one frame and has a Loco_Sync_Job
+    // copying it in chunks, its text is part new and part old until the job is done.
+    Loco_Pair_Flag_Syncing = (1 << 3),
+    // source_hash and yeet_hash hold the hashes of the pair's two sides, see loco_yeet_verify.
+    Loco_Pair_Flag_Hashed = (1 << 4),
+    // The last verify found the yeet block's text differs from its source, or a sheet edit
+    // deleted the block's text or replaced it along with other blocks and wasn't written back.
+    Loco_Pair_Flag_Diverged = (1 << 5),
+};
+
+// @yeettype @persist
+// The source side of a pair that goes dormant or is bound again, the same for every copy
+// of the pair with that uid. See loco_set_every_pair_source.
+struct Loco_Pair_Source
 {
+    Buffer_ID buffer;
     i32 start_marker_idx;
     i32 end_marker_idx;
-    i32 yeet_start_marker_idx;
-    i32 yeet_end_marker_idx;
+    Range_i64 dormant_range;
+    Loco_Fingerprint fingerprint;
+};
+
+// @yeettype @sync @chunk
+// A big block being copied from its source in chunks. The first done bytes of the yeet
+// block already match the source, the rest of the block is still the old text.
+struct Loco_Sync_Job
+{
+    Buffer_ID yeet_buffer;
+    u64 uid;
+    i64 done;
+};
+
+// @yeettype @sync @chunk
+struct Loco_Sync_Jobs
+{
+    Loco_Sync_Job *jobs;
+    i32 count;
+    i32 cap;
+};
+
+// @yeettype @sync
+// Per sheet or source buffer, the text edited since the last flush or verify, in the
+// buffer's current coordinates. The ranges are sorted and disjoint, only edits that touch
+// are merged, so the cursors of a multi-cursor edit keep a range each. When all 16 are
+// used the two closest are merged.
+struct Loco_Dirty_Ranges
+{
+    Range_i64 ranges[16];
+    // Set while a range is the new text of one edit and wasn't merged with another.
+    b8 is_one_edit[16];
+    i32 count;
+};
+
+// @yeettype @render
+// Where the lines of a buffer start, so that all the line numbers a frame draws are found
+// without a core call each. Built on first use, then kept up to date by the edit hook,
+// which only scans the new text of an edit.
+struct Loco_Line_Table
+{
+    i64 *starts;
+    i64 count;
+    i64 cap;
+    bool is_built;
+};
+
+// @yeettype @sync
+// Where a dirty range lies against a block, in the coordinates after the edit. A block's
+// start marker leans left and its end marker leans right, so text inserted right at either
+// edge of a block joins it, and an edit that replaced the whole block leaves the block
+// holding exactly the new text.
+enum Loco_Block_Edit_Kind
+{
+    // Doesn't reach the block.
+    Loco_Block_Edit_None,
+    // Strictly inside the block, both copies keep their first and last bytes.
+    Loco_Block_Edit_Inside,
+    // Inside the block and reaching its first or last byte, e.g. typing right before or
+    // after it, or a deletion that only removed text next to it.
+    Loco_Block_Edit_At_Edge,
+    // Crosses one edge. The markers pull a single edit inside the block, so this is edits
+    // inside and outside of it that were merged into one dirty range.
+    Loco_Block_Edit_Spanning,
+    // Covers the whole block, its text was replaced or deleted.
+    Loco_Block_Edit_Enclosing,
+};
+
+// @yeettype @anchor
+// Per source buffer, what edits since the last tick did to its pairs' anchors.
+struct Loco_Anchor_State
+{
+    // Edits near blocks, their fingerprints are refreshed in loco_tick.
+    Range_i64 dirty_range;
+    bool has_dirty_range;
+    // An edit swallowed whole blocks (e.g. a reload), they are searched for in loco_tick.
+    bool needs_reanchor;
+};
+
+// @yeettype @snapshot
+struct Loco_Yeet_Snapshot
+{
+    Loco_Yeet_Snapshot *next;
+    String_Const_u8 name;
+    Loco_Pair_Table *table;
+};
+
+// @yeettype @snapshot
+// Named snapshots, kept in the order they were first saved.
+struct Loco_Yeets_Snapshots
+{
+    Loco_Yeet_Snapshot *first;
+    Loco_Yeet_Snapshot *last;
+    i32 count;
+};
+
+// @yeettype @history
+// Earlier and undone versions of the live pair table, oldest first. A version is a
+// reference to a whole table, but tables share the chunks they have in common, so a
+// version only costs the chunks that changed after it.
+struct Loco_Yeet_History
+{
+    Loco_Pair_Table **undo;
+    Loco_Pair_Table **redo;
+    i32 undo_count;
+    i32 redo_count;
+    i32 cap;
+    // Set between loco_yeet_history_begin and loco_yeet_history_end.
+    bool is_pending;
+};
+
+// @yeettype @sheet
+// Small unordered set of buffers, allocated from the system allocator.
+struct Loco_Buffer_Set
+{
+    Buffer_ID *ids;
+    i32 count;
+    i32 cap;
+};
+
+// @yeettype @sheet
+// Attached to every buffer, is_sheet is only set on yeet sheets. Each sheet keeps its
+// own undo history next to its pair table.
+struct Loco_Yeet_Sheet
+{
+    bool is_sheet;
+    // A portal sheet holds a one line stand-in per block instead of a copy of its text,
+    // the block is read and edited in its source through a portal view.
+    bool is_portal;
+    // A read-only sheet is a one way mirror. Source edits only note the source here, its
+    // blocks are marked stale once per frame and the visible ones re-copied.
+    bool is_read_only;
+    Loco_Buffer_Set dirty_sources;
+    Loco_Yeet_History history;
+};
+
+// @yeettype @portal
+// Attached to a view that shows a source buffer through a block of a portal sheet. The
+// text outside the block is dimmed, and the portal closes once the cursor leaves it.
+struct Loco_Portal
+{
     Buffer_ID buffer;
+    i32 start_marker_idx;
+    i32 end_marker_idx;
+};
+
+// @yeettype @sheet
+struct Loco_Yeet_Sheets
+{
+    // Every open sheet.
+    Loco_Buffer_Set buffers;
+    // The sheet commands act on, the last one that was in the active view.
+    Buffer_ID current;
+};
+
+// @yeettype @persist
+// Interned file paths. Pairs store a small id instead of a string so they stay plain data.
+struct Loco_Path_Table
+{
+    Arena arena;
+    Table_Data_u64 ids;
+    // paths[0] is unused, id 0 means "no file".
+    String_Const_u8 *paths;
+    u32 count;
+    u32 cap;
+    // Ids of the files that have dormant pairs, so opening any other file costs one lookup.
+    Table_u64_u64 dormant_ids;
+    bool is_initialized;
+};
+
+// @yeettype @session
+struct Loco_Session_State
+{
+    // What the journal holds, the next save only appends the chunks that differ from it.
+    Loco_Pair_Table *saved_table;
+    // Path ids the journal has a path record for.
+    Table_u64_u64 written_paths;
+    bool has_written_paths;
+    bool active_changed;
+    bool is_started;
+    u64 file_size;
+    u64 compacted_size;
+    u64 last_save_time;
 };
 
 // @yeettype
-struct Loco_Yeets
+struct Loco_Range_Node
 {
-    Loco_Marker_Pair pairs[1024];
-    i32 pairs_count;
+    Loco_Range_Node *next;
+    Range_i64 range;
 };
 
 // @yeettype
-struct Loco_Yeets_Snapshots
+// Arena backed list of ranges, grows one node per range so it costs O(count).
+struct Loco_Range_List
 {
-    Loco_Yeets snapshots[3];
-    i32 snapshots_count;
+    Loco_Range_Node *first;
+    Loco_Range_Node *last;
+    i64 count;
 };
 
 //--GLOBALS
@@ -96,11 +423,58 @@ global FColor loco_yeet_source_comment_color = fcolor_change_alpha(f_green, 0.35
 global FColor loco_yeet_highlight_start_color = fcolor_argb(0.f, 1.f, 0.f, 0.06f);
 global FColor loco_yeet_highlight_end_color = fcolor_argb(0.f, 0.f, 1.f, 0.05f);
 
+// Set this to true to load snapshots with a placeholder per block, the text of a block is
+// only copied from its source once it's visible in a yeet view (see loco_tick).
+global bool loco_yeet_lazy_snapshot_load = false;
+global char *loco_yeet_lazy_placeholder = "...";
+
+// Source edits to blocks that no yeet view shows only mark them stale. On frames without
+// edits up to loco_yeet_idle_drain_count stale blocks are copied, another frame is asked
+// for every loco_yeet_idle_drain_ms while some are left.
+global i32 loco_yeet_idle_drain_count = 32;
+global u32 loco_yeet_idle_drain_ms = 50;
+
+// Portal sheets (see loco_yeet_new_portal_sheet) show this in place of each block, and
+// portal views dim the source text outside the block with this color.
+global char *loco_yeet_portal_placeholder = "[portal]";
+global FColor loco_yeet_portal_dim_color = fcolor_argb(0.f, 0.f, 0.f, 0.5f);
+
+// Re-anchoring. A fingerprint's context is this many lines either side of the block, but
+// no more than loco_yeet_anchor_context_bytes. The line fallback searches this many lines
+// either side of where the block was.
+global i32 loco_yeet_anchor_context_lines = 3;
+global i64 loco_yeet_anchor_context_bytes = 256;
+global i64 loco_yeet_anchor_head_size = 32;
+global i64 loco_yeet_anchor_search_lines = 4000;
+global bool loco_yeet_anchor_work_pending = false;
+
+// Named snapshots of the pair table. The slot commands use the names "1", "2" and "3".
 global Loco_Yeets_Snapshots yeets_snapshots = {};
 
-// This is set to true when editing either buffer so you don't get
-// infinite echoes of syncronization.
-global bool lock_yeet_buffer = false;
+// Snapshots are saved to this file in the 4coder binary directory and read back
+// the first time a snapshot is used.
+global char *loco_yeet_snapshot_file_name = "yeet_snapshots.bin";
+global bool loco_yeet_snapshot_file_loaded = false;
+// Set when the snapshots change, the file is written once from loco_tick or loco_on_exit.
+global bool loco_yeet_snapshot_file_dirty = false;
+
+// The live sheet is journaled to this file every loco_yeet_session_autosave_ms and on exit,
+// and restored by loco_on_startup. A save only appends the chunks of the pair table that
+// changed, the journal is rewritten whole once it's loco_yeet_session_compact_factor times
+// the size it had after the last rewrite.
+global char *loco_yeet_session_file_name = "yeet_session.bin";
+global u64 loco_yeet_session_autosave_ms = 2000;
+global u64 loco_yeet_session_compact_factor = 4;
+global Loco_Session_State loco_session = {};
+
+// Stands in for the yeet sheet where a command lets you pick it like a snapshot.
+global Loco_Yeet_Snapshot loco_live_yeet_snapshot = { 0, string_u8_litexpr("*yeet*"), 0 };
+
+// Name of the snapshot last saved or loaded.
+global String_Const_u8 loco_active_yeet_snapshot = {};
+
+global Loco_Path_Table loco_path_table = {};
+global u64 loco_yeet_next_uid = 1;
 
 // Set this to true to also delete the markers in the original buffer.
 // I've left this at false because we might want to store different
@@ -108,20 +482,249 @@ global bool lock_yeet_buffer = false;
 // be as simple as saving a snapshot of the Loco_Yeets structure.
 global bool loco_yeets_delete_og_markers = false;
 
+// Undo history of each yeet sheet. The oldest versions are dropped once there are more than
+// loco_yeet_history_max_count, or the chunks only they hold take more than
+// loco_yeet_history_max_bytes. There is no history while loco_yeets_delete_og_markers is
+// set, older versions would point at markers that were freed.
+global i32 loco_yeet_history_max_count = 64;
+global u64 loco_yeet_history_max_bytes = MB(8);
+
+// Sheets are buffers named "*yeet*" or "*yeet:NAME*". Every source buffer has a
+// Loco_Buffer_Set of the sheets that hold pairs from it, so an edit only reaches those.
+global char *loco_yeet_default_sheet_name = "*yeet*";
+global Loco_Yeet_Sheets loco_yeet_sheets = {};
+// Buffers with pending dirty ranges, see loco_flush_pending_sync.
+global Loco_Buffer_Set loco_yeet_pending_buffers = {};
+// There are stale blocks left for the idle drain.
+global bool loco_yeet_stale_pending = false;
+// The active view's buffer on the last tick, a sheet that just got focus catches up whole.
+global Buffer_ID loco_yeet_last_active_buffer = 0;
+
+// Blocks bigger than loco_yeet_sync_chunk_size are copied a chunk at a time, for at most
+// loco_yeet_sync_budget_us per frame, so typing stays responsive however big a yeet is.
+global i64 loco_yeet_sync_chunk_size = KB(64);
+global u64 loco_yeet_sync_budget_us = 4000;
+global Loco_Sync_Jobs loco_yeet_sync_jobs = {};
+// The sheet a streamed copy is writing, loco_on_buffer_edit ignores its chunks and hears
+// about the whole copy once it's done.
+global Buffer_ID loco_yeet_streaming_buffer = 0;
+
+// Set to true to have loco_yeet_verify copy diverged blocks from their source again,
+// instead of only marking them.
+global bool loco_yeet_verify_repair = false;
+
 //--IMPLEMENTATIONS
 
-//~
+//--SHEETS
+
+//~ @sheet
+static void
+loco_buffer_set_add(Loco_Buffer_Set *set, Buffer_ID buffer)
+{
+    for (i32 i = 0; i < set->count; i++)
+    {
+        if (set->ids[i] == buffer) return;
+    }
+    if (set->count == set->cap)
+    {
+        Base_Allocator *allocator = get_base_allocator_system();
+        i32 new_cap = set->cap*2 + 4;
+        Buffer_ID *new_ids = (Buffer_ID*)base_allocate(allocator, sizeof(Buffer_ID)*new_cap).data;
+        block_copy(new_ids, set->ids, sizeof(Buffer_ID)*set->count);
+        if (set->ids != 0) base_free(allocator, set->ids);
+        set->ids = new_ids;
+        set->cap = new_cap;
+    }
+    set->ids[set->count++] = buffer;
+}
+
+//~ @sheet
+static void
+loco_buffer_set_remove(Loco_Buffer_Set *set, Buffer_ID buffer)
+{
+    for (i32 i = 0; i < set->count; i++)
+    {
+        if (set->ids[i] == buffer)
+        {
+            set->ids[i] = set->ids[set->count - 1];
+            set->count -= 1;
+            return;
+        }
+    }
+}
+
+//~ @sheet
+static void
+loco_buffer_set_free(Loco_Buffer_Set *set)
+{
+    if (set->ids != 0) base_free(get_base_allocator_system(), set->ids);
+    block_zero_struct(set);
+}
+
+//~ @sheet
+static Loco_Yeet_Sheet*
+loco_get_yeet_sheet(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_sheet_handle, Loco_Yeet_Sheet);
+}
+
+//~ @sheet
+static bool
+loco_is_yeet_sheet(Application_Links *app, Buffer_ID buffer)
+{
+    return buffer_exists(app, buffer) && loco_get_yeet_sheet(app, buffer)->is_sheet;
+}
+
+//~ @sheet
+// The sheets that hold pairs from a source buffer.
+static Loco_Buffer_Set*
+loco_get_source_sheets(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_source_sheets_handle, Loco_Buffer_Set);
+}
+
+//~ @sync
+// Every buffer has a guard that is held while the sync itself writes to it, so the edit
+// hook doesn't send that edit on again. A guard per buffer instead of one global lock lets
+// an edit travel from a sheet to its source and on to the source's other mirrors.
+static i32*
+loco_get_sync_guard(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_sync_guard_handle, i32);
+}
+
+//~ @sync
+static void
+loco_sync_guard_push(Application_Links *app, Buffer_ID buffer)
+{
+    *loco_get_sync_guard(app, buffer) += 1;
+}
+
+//~ @sync
+static void
+loco_sync_guard_pop(Application_Links *app, Buffer_ID buffer)
+{
+    *loco_get_sync_guard(app, buffer) -= 1;
+}
+
+//~ @sync @chunk
+static Loco_Sync_Job*
+loco_find_sync_job(Buffer_ID yeet_buffer, u64 uid)
+{
+    for (i32 i = 0; i < loco_yeet_sync_jobs.count; i++)
+    {
+        Loco_Sync_Job *job = &loco_yeet_sync_jobs.jobs[i];
+        if (job->yeet_buffer == yeet_buffer && job->uid == uid) return job;
+    }
+    return 0;
+}
+
+//~ @sync @chunk
+static void
+loco_add_sync_job(Buffer_ID yeet_buffer, u64 uid, i64 done)
+{
+    Loco_Sync_Job *job = loco_find_sync_job(yeet_buffer, uid);
+    if (job != 0)
+    {
+        job->done = Min(job->done, done);
+        return;
+    }
+    Loco_Sync_Jobs *jobs = &loco_yeet_sync_jobs;
+    if (jobs->count == jobs->cap)
+    {
+        Base_Allocator *allocator = get_base_allocator_system();
+        i32 new_cap = (jobs->cap == 0) ? 8 : jobs->cap*2;
+        Loco_Sync_Job *new_jobs = (Loco_Sync_Job*)base_allocate(allocator, sizeof(Loco_Sync_Job)*new_cap).data;
+        if (jobs->jobs != 0)
+        {
+            block_copy(new_jobs, jobs->jobs, sizeof(Loco_Sync_Job)*jobs->count);
+            base_free(allocator, jobs->jobs);
+        }
+        jobs->jobs = new_jobs;
+        jobs->cap = new_cap;
+    }
+    job = &jobs->jobs[jobs->count++];
+    job->yeet_buffer = yeet_buffer;
+    job->uid = uid;
+    job->done = done;
+}
+
+//~ @sheet
+// Finds or makes the sheet with this name.
+static Buffer_ID
+loco_make_yeet_sheet(Application_Links *app, String_Const_u8 name)
+{
+    Buffer_ID sheet = get_buffer_by_name(app, name, Access_Always);
+    if (!buffer_exists(app, sheet))
+    {
+        sheet = create_buffer(app, name, BufferCreate_AlwaysNew);
+        buffer_set_setting(app, sheet, BufferSetting_Unimportant, true);
+    }
+    Loco_Yeet_Sheet *sheet_data = loco_get_yeet_sheet(app, sheet);
+    if (!sheet_data->is_sheet)
+    {
+        sheet_data->is_sheet = true;
+        loco_buffer_set_add(&loco_yeet_sheets.buffers, sheet);
+    }
+    return sheet;
+}
+
+//~ @sheet
+static void
+loco_set_current_yeet_sheet(Application_Links *app, Buffer_ID buffer)
+{
+    if (loco_is_yeet_sheet(app, buffer))
+    {
+        loco_yeet_sheets.current = buffer;
+    }
+}
+
+//~ @sheet
+// The sheet commands act on, made if there is none yet.
 static Buffer_ID
 loco_get_yeet_buffer(Application_Links *app)
 {
-    String_Const_u8 yeet_name = string_u8_litexpr("*yeet*");
-    Buffer_ID yeet_buffer = get_buffer_by_name(app, yeet_name, Access_Always);
-    if (!buffer_exists(app, yeet_buffer))
+    if (!loco_is_yeet_sheet(app, loco_yeet_sheets.current))
+    {
+        loco_yeet_sheets.current = loco_make_yeet_sheet(app, SCu8(loco_yeet_default_sheet_name));
+    }
+    return loco_yeet_sheets.current;
+}
+
+//~ @sheet @pairtable
+// Keeps the source index in step with a sheet's pair table. Sources of the new table point
+// at the sheet, sources only the old table had stop pointing at it.
+static void
+loco_reindex_sheet_sources(Application_Links *app, Buffer_ID sheet, Loco_Pair_Table *old_table, Loco_Pair_Table *new_table)
+{
+    if (old_table == new_table) return;
+    Table_u64_u64 seen = make_table_u64_u64(get_base_allocator_system(), 64);
+    Loco_Pair_Table *tables[2] = { new_table, old_table };
+    for (i32 t = 0; t < 2; t++)
     {
-        yeet_buffer = create_buffer(app, yeet_name, BufferCreate_AlwaysNew);
-        buffer_set_setting(app, yeet_buffer, BufferSetting_Unimportant, true);
+        Loco_Pair_Table *table = tables[t];
+        if (table == 0) continue;
+        for (i32 c = 0; c < table->chunks_count; c++)
+        {
+            Loco_Pair_Chunk *chunk = table->chunks[c];
+            for (i32 i = 0; i < chunk->count; i++)
+            {
+                Buffer_ID buffer = chunk->pairs[i].buffer;
+                u64 existing = 0;
+                if (buffer == 0 || table_read(&seen, (u64)buffer, &existing)) continue;
+                table_insert(&seen, (u64)buffer, 0);
+                if (!buffer_exists(app, buffer)) continue;
+                
+                Loco_Buffer_Set *sheets = loco_get_source_sheets(app, buffer);
+                if (t == 0) loco_buffer_set_add(sheets, sheet);
+                else loco_buffer_set_remove(sheets, sheet);
+            }
+        }
     }
-    return yeet_buffer;
+    table_free(&seen);
 }
 
 //~ @marker @buffer
@@ -153,32 +756,160 @@ loco_overwrite_buffer_markers(Application_Links *app, Arena *arena, Buffer_ID bu
     managed_object_store_data(app, *markers_obj, 0, count, markers);
 }
 
+//~ @sort
+// Sorts the indices in order by the keys they refer to, keeping the order of equal keys.
+// sort_pairs_by_key only takes i32 keys, buffer positions can be bigger.
+static void
+loco_sort_by_key_i64(Arena *arena, i64 *keys, i32 *order, i32 count)
+{
+    Temp_Memory temp = begin_temp(arena);
+    i32 *other = push_array(arena, i32, count);
+    i32 *src = order;
+    i32 *dst = other;
+    for (i32 width = 1; width < count; width *= 2)
+    {
+        for (i32 lo = 0; lo < count; lo += width*2)
+        {
+            i32 mid = Min(lo + width, count);
+            i32 hi = Min(lo + width*2, count);
+            i32 a = lo;
+            i32 b = mid;
+            for (i32 k = lo; k < hi; k++)
+            {
+                if (a < mid && (b >= hi || keys[src[a]] <= keys[src[b]])) dst[k] = src[a++];
+                else dst[k] = src[b++];
+            }
+        }
+        i32 *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != order) block_copy(order, src, sizeof(i32)*count);
+    end_temp(temp);
+}
+
+//~ @pairtable
+static Loco_Pair_Table**
+loco_get_yeet_pair_table(Application_Links *app, Buffer_ID yeet_buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, yeet_buffer);
+    return scope_attachment(app, scope, loco_marker_pair_handle, Loco_Pair_Table*);
+}
+
 //~ @overwrite
+// Stores the pairs as the sheet's table, in the order of their blocks. Snapshots, history
+// versions and the session journal only keep the table, this is how they know the order.
+// Blocks can't pass each other, so the order holds until the table is stored again.
+// The caller's array keeps its order.
 static void
 loco_overwrite_yeets(Application_Links *app, Buffer_ID yeet_buffer, Loco_Yeets* yeets)
 {
-    Managed_Scope yeet_scope = buffer_get_managed_scope(app, yeet_buffer);
-    Managed_Object* pair_obj = scope_attachment(app, yeet_scope, loco_marker_pair_handle, Managed_Object);
-    
-    i32 count = managed_object_get_item_count(app, *pair_obj);
-    if (count == 0)
+    Scratch_Block scratch(app);
+    i32 yeet_markers_count = 0;
+    Marker *yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    i64 *keys = push_array(scratch, i64, yeets->pairs_count);
+    bool is_sorted = true;
+    for (i32 i = 0; i < yeets->pairs_count; i++)
+    {
+        i32 idx = yeets->pairs[i].yeet_start_marker_idx;
+        keys[i] = (idx >= 0 && idx < yeet_markers_count) ? yeet_markers[idx].pos : max_i64;
+        if (i > 0 && keys[i] < keys[i - 1]) is_sorted = false;
+    }
+    Loco_Marker_Pair *pairs = yeets->pairs;
+    if (!is_sorted)
     {
-        *pair_obj = alloc_managed_memory_in_scope(
-                                                  app, yeet_scope, sizeof(Loco_Yeets), 1);
+        i32 *order = push_array(scratch, i32, yeets->pairs_count);
+        for (i32 i = 0; i < yeets->pairs_count; i++) order[i] = i;
+        loco_sort_by_key_i64(scratch, keys, order, yeets->pairs_count);
+        pairs = push_array(scratch, Loco_Marker_Pair, yeets->pairs_count);
+        for (i32 i = 0; i < yeets->pairs_count; i++) pairs[i] = yeets->pairs[order[i]];
     }
     
-    managed_object_store_data(app, *pair_obj, 0, 1, yeets);
+    Loco_Pair_Table **live_table = loco_get_yeet_pair_table(app, yeet_buffer);
+    Loco_Pair_Table *table = loco_pair_table_make(pairs, yeets->pairs_count, *live_table);
+    loco_reindex_sheet_sources(app, yeet_buffer, *live_table, table);
+    loco_pair_table_release(*live_table);
+    *live_table = table;
 }
 
 //~ @buffer
 static Loco_Yeets
-loco_get_buffer_yeets(Application_Links *app, Buffer_ID buffer_id)
+loco_get_buffer_yeets(Application_Links *app, Arena *arena, Buffer_ID buffer_id)
 {
-    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
-    Managed_Object* man_obj = scope_attachment(app, scope, loco_marker_pair_handle, Managed_Object);
+    Loco_Pair_Table **live_table = loco_get_yeet_pair_table(app, buffer_id);
+    return loco_pair_table_flatten(arena, *live_table);
+}
+
+//~ @append
+// Append an array of pairs to the yeet buffer's pair table.
+static void
+loco_append_yeet_pairs(Application_Links *app, Buffer_ID yeet_buffer, Loco_Marker_Pair *new_pairs, i32 count)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets old_yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
     Loco_Yeets yeets = {};
-    managed_object_load_data(app, *man_obj, 0, 1, &yeets);
-    return yeets;
+    yeets.pairs_count = old_yeets.pairs_count + count;
+    yeets.pairs = push_array(scratch, Loco_Marker_Pair, yeets.pairs_count);
+    block_copy(yeets.pairs, old_yeets.pairs, sizeof(Loco_Marker_Pair)*old_yeets.pairs_count);
+    block_copy(yeets.pairs + old_yeets.pairs_count, new_pairs, sizeof(Loco_Marker_Pair)*count);
+    loco_overwrite_yeets(app, yeet_buffer, &yeets);
+}
+
+//~ @range
+static void
+loco_range_list_push(Arena *arena, Loco_Range_List *list, Range_i64 range)
+{
+    Loco_Range_Node *node = push_array(arena, Loco_Range_Node, 1);
+    node->next = 0;
+    node->range = range;
+    if (list->last == 0)
+    {
+        list->first = node;
+    }
+    else
+    {
+        list->last->next = node;
+    }
+    list->last = node;
+    list->count += 1;
+}
+
+//~ @range
+static void
+loco_sort_ranges_by_min(Range_i64 *ranges, i64 count)
+{
+    // Plain quicksort, ranges are usually already close to sorted so use the middle pivot.
+    while (count > 1)
+    {
+        i64 pivot = ranges[count/2].min;
+        i64 lo = 0;
+        i64 hi = count - 1;
+        while (lo <= hi)
+        {
+            while (ranges[lo].min < pivot) lo += 1;
+            while (ranges[hi].min > pivot) hi -= 1;
+            if (lo <= hi)
+            {
+                Range_i64 temp = ranges[lo];
+                ranges[lo] = ranges[hi];
+                ranges[hi] = temp;
+                lo += 1;
+                hi -= 1;
+            }
+        }
+        // Recurse into the smaller half, loop on the larger one.
+        if (hi + 1 < count - lo)
+        {
+            loco_sort_ranges_by_min(ranges, hi + 1);
+            ranges += lo;
+            count -= lo;
+        }
+        else
+        {
+            loco_sort_ranges_by_min(ranges + lo, count - lo);
+            count = hi + 1;
+        }
+    }
 }
 
 //~ @marker @append
@@ -254,7 +985,8 @@ loco_delete_marker_pair(Application_Links *app, Buffer_ID yeet_buffer, Loco_Yeet
     
     // Need to swap out the indices too
     // becuase we've swapped deleted the markers so their index has changed.
-    if (loco_yeets_delete_og_markers && new_pair.buffer == pair.buffer)
+    bool delete_og_markers = loco_yeets_delete_og_markers && !HasFlag(pair.flags, Loco_Pair_Flag_Dormant);
+    if (delete_og_markers && new_pair.buffer == pair.buffer)
     {
         new_pair.start_marker_idx = pair.start_marker_idx;
         new_pair.end_marker_idx = pair.end_marker_idx;
@@ -271,7 +1003,7 @@ loco_delete_marker_pair(Application_Links *app, Buffer_ID yeet_buffer, Loco_Yeet
     yeet_marker_count -= 2;
     
     // Swap delete og markers.
-    if (loco_yeets_delete_og_markers)
+    if (delete_og_markers)
     {
         i32 og_marker_count = 0;
         Marker* og_markers = loco_get_buffer_markers(app, scratch, pair.buffer, &og_marker_count);
@@ -291,432 +1023,4251 @@ loco_delete_marker_pair(Application_Links *app, Buffer_ID yeet_buffer, Loco_Yeet
     buffer_replace_range(app, yeet_buffer, yeet_range, empty_str);
 }
 
-//~ @buffer @edit
+//--HISTORY
+
+//~ @history @pairtable
 static void
-loco_on_yeet_buffer_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
+loco_yeet_history_drop_oldest(Loco_Pair_Table **versions, i32 *count)
 {
-    i64 insert_size = range_size(new_range);
-    i64 text_shift = replace_range_shift(old_range, insert_size);
-    u8 insert_char = buffer_get_char(app, buffer_id, old_range.min);
-    
-    Scratch_Block scratch(app);
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, buffer_id);
-    i32 yeet_markers_count = 0;
-    Marker* yeet_markers = loco_get_buffer_markers(app, scratch, buffer_id, &yeet_markers_count);
-    for (size_t i = 0; i < yeets.pairs_count; i++)
+    if (*count == 0) return;
+    loco_pair_table_release(versions[0]);
+    *count -= 1;
+    for (i32 i = 0; i < *count; i++) versions[i] = versions[i + 1];
+}
+
+//~ @history @pairtable
+static void
+loco_yeet_history_clear(Loco_Yeet_History *history)
+{
+    while (history->undo_count > 0) loco_yeet_history_drop_oldest(history->undo, &history->undo_count);
+    while (history->redo_count > 0) loco_yeet_history_drop_oldest(history->redo, &history->redo_count);
+    history->is_pending = false;
+}
+
+//~ @history @pairtable
+// Adds delta to the number of versions in refs that hold key. Keys held outside the
+// history are stored with a count of 0 and never change. Returns the bytes that became
+// held or free, only the first version to hold a key pays for it.
+static u64
+loco_yeet_history_ref(Table_u64_u64 *refs, u64 key, i32 delta, u64 size)
+{
+    u64 count = 0;
+    if (table_read(refs, key, &count) && count == 0) return 0;
+    u64 new_count = count + delta;
+    table_erase(refs, key);
+    if (new_count > 0) table_insert(refs, key, new_count);
+    return (count == 0 || new_count == 0) ? size : 0;
+}
+
+//~ @history @pairtable
+// Counts one version more (delta 1) or less (delta -1) in refs. A table's chunks are
+// only counted once per table, no matter how many versions hold it.
+static u64
+loco_yeet_history_ref_version(Table_u64_u64 *refs, Loco_Pair_Table *table, i32 delta)
+{
+    if (table == 0) return 0;
+    u64 table_size = sizeof(Loco_Pair_Table) + sizeof(Loco_Pair_Chunk*)*table->chunks_count;
+    u64 bytes = loco_yeet_history_ref(refs, (u64)table, delta, table_size);
+    if (bytes == 0) return 0;
+    for (i32 c = 0; c < table->chunks_count; c++)
     {
-        Loco_Marker_Pair& pair = yeets.pairs[i];
-        if (!buffer_exists(app, pair.buffer)) continue;
-        
-        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
-        if (old_range.min > yeet_range.min && new_range.max < yeet_range.max)
-        {
-            // User edited inside a yeet block.
-            Scratch_Block og_scratch(app);
-            i32 og_markers_count = 0;
-            Marker* og_markers = loco_get_buffer_markers(app, og_scratch, pair.buffer, &og_markers_count);
-            Range_i64 og_range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
-            String_Const_u8 string = push_buffer_range(app, og_scratch, buffer_id, yeet_range);
-            buffer_replace_range(
-                                 app, 
-                                 pair.buffer,
-                                 og_range,
-                                 string
-                                 );
-        }
+        bytes += loco_yeet_history_ref(refs, (u64)table->chunks[c], delta, sizeof(Loco_Pair_Chunk));
     }
+    return bytes;
 }
 
-//~ @buffer @edit
-static void
-loco_on_original_buffer_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
+//~ @history @pairtable
+// Fills refs with every table and chunk the history holds. Returns the bytes of the ones
+// only this history keeps alive, anything a yeet sheet or a snapshot also holds is free.
+static u64
+loco_yeet_history_count_refs(Application_Links *app, Loco_Yeet_History *history, Table_u64_u64 *refs)
 {
-    i64 insert_size = range_size(new_range);
-    i64 text_shift = replace_range_shift(old_range, insert_size);
-    u8 insert_char = buffer_get_char(app, buffer_id, old_range.min);
-    
-    // Get the yeet buffer.
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    if (!buffer_exists(app, yeet_buffer) || buffer_id == yeet_buffer) return;
-    
-    // Check if this buffer exists in the yeet list.
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
-    bool exists_in_yeets = false;
-    for (i32 i = 0; i < yeets.pairs_count; i++)
+    i32 sheets_count = loco_yeet_sheets.buffers.count;
+    Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first;
+    for (i32 t = 0; t < sheets_count || snapshot != 0; t++)
     {
-        if (yeets.pairs[i].buffer == buffer_id)
+        Loco_Pair_Table *table = 0;
+        if (t < sheets_count)
         {
-            exists_in_yeets = true;
-            break;
+            table = *loco_get_yeet_pair_table(app, loco_yeet_sheets.buffers.ids[t]);
+        }
+        else
+        {
+            table = snapshot->table;
+            snapshot = snapshot->next;
         }
+        if (table == 0) continue;
+        table_insert(refs, (u64)table, 0);
+        for (i32 c = 0; c < table->chunks_count; c++) table_insert(refs, (u64)table->chunks[c], 0);
     }
-    if (!exists_in_yeets) return;
     
-    // Get yeet list and markers for both buffers.
+    u64 bytes = 0;
+    for (i32 v = 0; v < history->undo_count + history->redo_count; v++)
+    {
+        Loco_Pair_Table *table = (v < history->undo_count) ? history->undo[v] : history->redo[v - history->undo_count];
+        bytes += loco_yeet_history_ref_version(refs, table, 1);
+    }
+    return bytes;
+}
+
+//~ @history @pairtable
+// Bytes of the tables and chunks only this history keeps alive.
+static u64
+loco_yeet_history_memory(Application_Links *app, Loco_Yeet_History *history)
+{
+    Table_u64_u64 refs = make_table_u64_u64(get_base_allocator_system(), 256);
+    u64 bytes = loco_yeet_history_count_refs(app, history, &refs);
+    table_free(&refs);
+    return bytes;
+}
+
+//~ @history
+// Call before a command changes the sheet. Remembering the sheet only takes a reference
+// to the live table.
+static void
+loco_yeet_history_begin(Application_Links *app)
+{
+    if (loco_yeets_delete_og_markers) return;
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Loco_Yeet_History *history = &loco_get_yeet_sheet(app, yeet_buffer)->history;
+    if (history->cap == 0)
+    {
+        Base_Allocator *allocator = get_base_allocator_system();
+        history->cap = clamp_bot(loco_yeet_history_max_count, 1);
+        history->undo = (Loco_Pair_Table**)base_allocate(allocator, sizeof(Loco_Pair_Table*)*history->cap).data;
+        history->redo = (Loco_Pair_Table**)base_allocate(allocator, sizeof(Loco_Pair_Table*)*history->cap).data;
+    }
+    if (history->undo_count == history->cap) loco_yeet_history_drop_oldest(history->undo, &history->undo_count);
+    Loco_Pair_Table *live_table = *loco_get_yeet_pair_table(app, yeet_buffer);
+    history->undo[history->undo_count++] = loco_pair_table_retain(live_table);
+    history->is_pending = true;
+}
+
+//~ @history
+// Call after the command. A command that left the sheet as it was leaves no version,
+// one that changed it drops what was undone before and trims the history to its limits.
+static void
+loco_yeet_history_end(Application_Links *app)
+{
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Loco_Yeet_History *history = &loco_get_yeet_sheet(app, yeet_buffer)->history;
+    if (!history->is_pending) return;
+    history->is_pending = false;
+    
+    Loco_Pair_Table *live_table = *loco_get_yeet_pair_table(app, yeet_buffer);
+    if (history->undo[history->undo_count - 1] == live_table)
+    {
+        history->undo_count -= 1;
+        loco_pair_table_release(live_table);
+        return;
+    }
+    while (history->redo_count > 0) loco_yeet_history_drop_oldest(history->redo, &history->redo_count);
+    
+    // Count once, then take off what each dropped version alone was holding.
+    Table_u64_u64 refs = make_table_u64_u64(get_base_allocator_system(), 256);
+    u64 bytes = loco_yeet_history_count_refs(app, history, &refs);
+    while (history->undo_count > 1 && bytes > loco_yeet_history_max_bytes)
+    {
+        bytes -= loco_yeet_history_ref_version(&refs, history->undo[0], -1);
+        loco_yeet_history_drop_oldest(history->undo, &history->undo_count);
+    }
+    table_free(&refs);
+}
+
+//--SNAPSHOT-FILE
+
+//~ @snapshot
+static Loco_Yeet_Snapshot*
+loco_find_yeet_snapshot(String_Const_u8 name)
+{
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        if (string_match(snapshot->name, name)) return snapshot;
+    }
+    return 0;
+}
+
+//~ @snapshot
+// Finds the snapshot with this name, or appends an empty one.
+static Loco_Yeet_Snapshot*
+loco_get_or_make_yeet_snapshot(String_Const_u8 name)
+{
+    Loco_Yeet_Snapshot *snapshot = loco_find_yeet_snapshot(name);
+    if (snapshot == 0)
+    {
+        // The name is stored right after the node.
+        Base_Allocator *allocator = get_base_allocator_system();
+        u8 *memory = (u8*)base_allocate(allocator, sizeof(Loco_Yeet_Snapshot) + name.size).data;
+        snapshot = (Loco_Yeet_Snapshot*)memory;
+        block_zero_struct(snapshot);
+        snapshot->name = SCu8(memory + sizeof(Loco_Yeet_Snapshot), name.size);
+        block_copy(snapshot->name.str, name.str, name.size);
+        sll_queue_push(yeets_snapshots.first, yeets_snapshots.last, snapshot);
+        yeets_snapshots.count += 1;
+    }
+    return snapshot;
+}
+
+//~ @snapshot
+static void
+loco_remove_yeet_snapshot(Loco_Yeet_Snapshot *snapshot)
+{
+    Loco_Yeet_Snapshot *prev = 0;
+    for (Loco_Yeet_Snapshot *node = yeets_snapshots.first; node != 0; prev = node, node = node->next)
+    {
+        if (node != snapshot) continue;
+        if (prev != 0) prev->next = node->next;
+        else yeets_snapshots.first = node->next;
+        if (yeets_snapshots.last == node) yeets_snapshots.last = prev;
+        yeets_snapshots.count -= 1;
+        loco_pair_table_release(node->table);
+        base_free(get_base_allocator_system(), node);
+        break;
+    }
+}
+
+//~ @snapshot
+static void
+loco_free_yeet_snapshots(void)
+{
+    Base_Allocator *allocator = get_base_allocator_system();
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0;)
+    {
+        Loco_Yeet_Snapshot *next = snapshot->next;
+        loco_pair_table_release(snapshot->table);
+        base_free(allocator, snapshot);
+        snapshot = next;
+    }
+    yeets_snapshots = {};
+}
+
+//~ @snapshot @session
+static void
+loco_set_active_yeet_snapshot(String_Const_u8 name)
+{
+    if (string_match(name, loco_active_yeet_snapshot)) return;
+    Base_Allocator *allocator = get_base_allocator_system();
+    if (loco_active_yeet_snapshot.str != 0) base_free(allocator, loco_active_yeet_snapshot.str);
+    loco_active_yeet_snapshot = {};
+    if (name.size > 0)
+    {
+        loco_active_yeet_snapshot.str = (u8*)base_allocate(allocator, name.size).data;
+        loco_active_yeet_snapshot.size = name.size;
+        block_copy(loco_active_yeet_snapshot.str, name.str, name.size);
+    }
+    loco_session.active_changed = true;
+}
+
+//~ @persist @hash
+// Polynomial hash, h = h*B + (c + 1) for every byte.
+// Being polynomial means it can also be rolled along a buffer.
+static u64
+loco_hash_bytes(u64 hash, u8 *bytes, i64 size)
+{
+    for (i64 i = 0; i < size; i++)
+    {
+        hash = hash*0x100000001b3ull + (u64)bytes[i] + 1;
+    }
+    return hash;
+}
+
+//~ @persist @hash
+static u64
+loco_hash_buffer_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
+{
+    u8 window[KB(4)];
+    u64 hash = 0;
+    for (i64 chunk_start = range.min; chunk_start < range.max; chunk_start += sizeof(window))
+    {
+        i64 chunk_end = chunk_start + sizeof(window);
+        if (chunk_end > range.max) chunk_end = range.max;
+        if (!buffer_read_range(app, buffer, Ii64(chunk_start, chunk_end), window)) break;
+        hash = loco_hash_bytes(hash, window, chunk_end - chunk_start);
+    }
+    return hash;
+}
+
+//~ @anchor @hash
+// Whole line around pos in text, without its newline.
+static Range_i64
+loco_line_range_in_text(String_Const_u8 text, i64 pos)
+{
+    Range_i64 line = Ii64(pos, pos);
+    while (line.min > 0 && text.str[line.min - 1] != '\n') line.min -= 1;
+    while (line.max < (i64)text.size && text.str[line.max] != '\n') line.max += 1;
+    return line;
+}
+
+//~ @anchor @hash
+// Fingerprints range, where text holds the buffer from text_start on. The text must reach
+// the whole lines range starts and ends on and loco_yeet_anchor_context_bytes either side,
+// or the ends of the buffer, so the result only depends on the buffer contents.
+static Loco_Fingerprint
+loco_fingerprint_from_text(String_Const_u8 text, i64 text_start, Range_i64 range)
+{
+    Loco_Fingerprint result = {};
+    i64 min = range.min - text_start;
+    i64 max = range.max - text_start;
+    if (min < 0 || max > (i64)text.size || min > max) return result;
+    
+    result.content_size = max - min;
+    result.content_hash = loco_hash_bytes(0, text.str + min, max - min);
+    result.head_hash = loco_hash_bytes(0, text.str + min, Min(max - min, loco_yeet_anchor_head_size));
+    
+    // Context, up to N whole lines either side.
+    i64 before = min;
+    for (i32 newlines = 0; before > 0 && min - before < loco_yeet_anchor_context_bytes; before--)
+    {
+        if (text.str[before - 1] == '\n' && ++newlines > loco_yeet_anchor_context_lines) break;
+    }
+    i64 after = max;
+    for (i32 newlines = 0; after < (i64)text.size && after - max < loco_yeet_anchor_context_bytes; after++)
+    {
+        if (text.str[after] == '\n' && ++newlines > loco_yeet_anchor_context_lines) break;
+    }
+    result.before_hash = loco_hash_bytes(0, text.str + before, min - before);
+    result.after_hash = loco_hash_bytes(0, text.str + max, after - max);
+    
+    Range_i64 first_line = loco_line_range_in_text(text, min);
+    Range_i64 last_line = loco_line_range_in_text(text, max);
+    result.first_line_hash = loco_hash_bytes(0, text.str + first_line.min, range_size(first_line));
+    result.last_line_hash = loco_hash_bytes(0, text.str + last_line.min, range_size(last_line));
+    result.start_column = (i32)(min - first_line.min);
+    result.end_column = (i32)(max - last_line.min);
+    for (i64 i = min; i < max; i++)
+    {
+        if (text.str[i] == '\n') result.line_count += 1;
+    }
+    return result;
+}
+
+//~ @anchor @hash @buffer
+// Reads the whole lines of range and the context around them, and fingerprints it.
+static Loco_Fingerprint
+loco_fingerprint_buffer_window(Application_Links *app, Buffer_ID buffer, Range_i64 range)
+{
+    Scratch_Block scratch(app);
+    i64 buffer_size = buffer_get_size(app, buffer);
+    i64 first_line = get_line_number_from_pos(app, buffer, range.min);
+    i64 last_line = get_line_number_from_pos(app, buffer, range.max);
+    Range_i64 window = {};
+    window.min = Min(get_line_start_pos(app, buffer, first_line), range.min - loco_yeet_anchor_context_bytes);
+    window.max = Max(get_line_end_pos(app, buffer, last_line), range.max + loco_yeet_anchor_context_bytes);
+    window.min = clamp_bot(window.min, 0);
+    window.max = clamp_top(window.max, buffer_size);
+    
+    String_Const_u8 text = {};
+    text.size = (u64)range_size(window);
+    text.str = push_array(scratch, u8, text.size);
+    if (!buffer_read_range(app, buffer, window, text.str))
+    {
+        Loco_Fingerprint empty = {};
+        return empty;
+    }
+    return loco_fingerprint_from_text(text, window.min, range);
+}
+
+//~ @anchor @hash @buffer
+// A range bigger than loco_yeet_sync_chunk_size isn't read in one piece. Its ends are
+// fingerprinted from the text around them and its content is hashed a chunk at a time,
+// which gives the same fingerprint as reading it whole.
+static Loco_Fingerprint
+loco_fingerprint_buffer_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
+{
+    if (range_size(range) <= loco_yeet_sync_chunk_size)
+    {
+        return loco_fingerprint_buffer_window(app, buffer, range);
+    }
+    
+    Loco_Fingerprint head = loco_fingerprint_buffer_window(app, buffer, Ii64(range.min));
+    Loco_Fingerprint tail = loco_fingerprint_buffer_window(app, buffer, Ii64(range.max));
+    Loco_Fingerprint result = {};
+    result.content_size = range_size(range);
+    result.head_hash = loco_hash_buffer_range(app, buffer, Ii64(range.min, range.min + Min(result.content_size, loco_yeet_anchor_head_size)));
+    result.before_hash = head.before_hash;
+    result.first_line_hash = head.first_line_hash;
+    result.start_column = head.start_column;
+    result.after_hash = tail.after_hash;
+    result.last_line_hash = tail.last_line_hash;
+    result.end_column = tail.end_column;
+    
+    u8 window[KB(4)];
+    for (i64 chunk_start = range.min; chunk_start < range.max; chunk_start += sizeof(window))
+    {
+        i64 chunk_end = Min(chunk_start + (i64)sizeof(window), range.max);
+        if (!buffer_read_range(app, buffer, Ii64(chunk_start, chunk_end), window)) break;
+        result.content_hash = loco_hash_bytes(result.content_hash, window, chunk_end - chunk_start);
+        for (i64 i = 0; i < chunk_end - chunk_start; i++)
+        {
+            if (window[i] == '\n') result.line_count += 1;
+        }
+    }
+    return result;
+}
+
+//~ @anchor
+static Loco_Anchor_State*
+loco_get_anchor_state(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_anchor_state_handle, Loco_Anchor_State);
+}
+
+//~ @anchor
+// Some text near blocks of this buffer changed, refresh their fingerprints on the next tick.
+static void
+loco_anchor_mark_dirty(Application_Links *app, Buffer_ID buffer, Range_i64 range)
+{
+    Loco_Anchor_State *state = loco_get_anchor_state(app, buffer);
+    state->dirty_range = state->has_dirty_range ? range_union(state->dirty_range, range) : range;
+    state->has_dirty_range = true;
+    loco_yeet_anchor_work_pending = true;
+}
+
+//~ @anchor
+// Blocks of this buffer lost their markers, search for them on the next tick.
+static void
+loco_anchor_mark_lost(Application_Links *app, Buffer_ID buffer)
+{
+    Loco_Anchor_State *state = loco_get_anchor_state(app, buffer);
+    state->needs_reanchor = true;
+    loco_yeet_anchor_work_pending = true;
+}
+
+//~ @persist
+static u32
+loco_intern_path(String_Const_u8 path)
+{
+    if (path.size == 0) return 0;
+    
+    Loco_Path_Table *table = &loco_path_table;
+    Base_Allocator *allocator = get_base_allocator_system();
+    if (!table->is_initialized)
+    {
+        table->arena = make_arena_system();
+        table->ids = make_table_Data_u64(allocator, 64);
+        table->dormant_ids = make_table_u64_u64(allocator, 64);
+        table->count = 1;
+        table->is_initialized = true;
+    }
+    
+    u64 id = 0;
+    if (table_read(&table->ids, make_data(path.str, path.size), &id))
+    {
+        return (u32)id;
+    }
+    
+    if (table->count >= table->cap)
+    {
+        u32 new_cap = (table->cap == 0) ? 64 : table->cap*2;
+        Data data = base_allocate(allocator, sizeof(String_Const_u8)*new_cap);
+        String_Const_u8 *new_paths = (String_Const_u8*)data.data;
+        if (table->paths != 0)
+        {
+            block_copy(new_paths, table->paths, sizeof(String_Const_u8)*table->count);
+            base_free(allocator, table->paths);
+        }
+        table->paths = new_paths;
+        table->cap = new_cap;
+    }
+    
+    String_Const_u8 copy = push_string_copy(&table->arena, path);
+    id = table->count;
+    table->paths[id] = copy;
+    table->count += 1;
+    table_insert(&table->ids, make_data(copy.str, copy.size), id);
+    return (u32)id;
+}
+
+//~ @persist
+// Like loco_intern_path but never adds the path, returns 0 if it isn't known.
+static u32
+loco_find_path_id(String_Const_u8 path)
+{
+    u64 id = 0;
+    if (path.size == 0 || !loco_path_table.is_initialized) return 0;
+    if (!table_read(&loco_path_table.ids, make_data(path.str, path.size), &id)) return 0;
+    return (u32)id;
+}
+
+//~ @persist
+static String_Const_u8
+loco_path_from_id(u32 file_id)
+{
+    String_Const_u8 result = {};
+    if (file_id > 0 && file_id < loco_path_table.count)
+    {
+        result = loco_path_table.paths[file_id];
+    }
+    return result;
+}
+
+//~ @persist @buffer
+static u32
+loco_buffer_file_id(Application_Links *app, Buffer_ID buffer)
+{
+    Scratch_Block scratch(app);
+    String_Const_u8 file_name = push_buffer_file_name(app, scratch, buffer);
+    return loco_intern_path(file_name);
+}
+
+//~ @persist
+static String_Const_u8
+loco_yeet_data_file_path(Arena *arena, char *file_name)
+{
+    String_Const_u8 binary_path = system_get_path(arena, SystemPath_Binary);
+    return push_u8_stringf(arena, "%.*s/%s", string_expand(binary_path), file_name);
+}
+
+//~ @persist @snapshot
+// Writes every snapshot to the snapshot file with a single write.
+// Pairs from buffers without a file can't be found again so they are left out. A pair
+// keeps the fingerprint it already has (see loco_refresh_fingerprints), no source is read.
+static bool
+loco_write_yeet_snapshots_file(Application_Links *app)
+{
+    loco_yeet_snapshot_file_dirty = false;
+    Scratch_Block scratch(app);
+    
+    u32 snapshot_count = (u32)yeets_snapshots.count;
+    u32 max_pair_count = 0;
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        if (snapshot->table != 0) max_pair_count += snapshot->table->pairs_count;
+    }
+    
+    u32 *path_index_from_id = push_array(scratch, u32, loco_path_table.count + 1);
+    for (u32 i = 0; i < loco_path_table.count + 1; i++) path_index_from_id[i] = max_u32;
+    Loco_Snapshot_File_Path *paths = push_array(scratch, Loco_Snapshot_File_Path, max_pair_count);
+    Loco_Snapshot_File_Snapshot *snapshots = push_array(scratch, Loco_Snapshot_File_Snapshot, snapshot_count);
+    Loco_Snapshot_File_Pair *pairs = push_array(scratch, Loco_Snapshot_File_Pair, max_pair_count);
+    u32 path_count = 0;
+    u32 pair_count = 0;
+    u32 string_bytes = 0;
+    
+    Buffer_ID cached_buffer = 0;
+    Marker *cached_markers = 0;
+    i32 cached_markers_count = 0;
+    
+    u32 s = 0;
+    for (Loco_Yeet_Snapshot *node = yeets_snapshots.first; node != 0; node = node->next, s++)
+    {
+        Loco_Yeets snapshot = loco_pair_table_flatten(scratch, node->table);
+        // The table is in sheet order already, see loco_overwrite_yeets.
+        snapshots[s].first_pair = pair_count;
+        for (i32 i = 0; i < snapshot.pairs_count; i++)
+        {
+            Loco_Marker_Pair pair = snapshot.pairs[i];
+            if (pair.file_id == 0 || pair.file_id >= loco_path_table.count) continue;
+            
+            Range_i64 range = pair.dormant_range;
+            if (!HasFlag(pair.flags, Loco_Pair_Flag_Dormant))
+            {
+                if (!buffer_exists(app, pair.buffer)) continue;
+                if (pair.buffer != cached_buffer)
+                {
+                    cached_buffer = pair.buffer;
+                    cached_markers = loco_get_buffer_markers(app, scratch, pair.buffer, &cached_markers_count);
+                }
+                if (pair.end_marker_idx >= cached_markers_count) continue;
+                range = loco_make_range_from_markers(cached_markers, pair.start_marker_idx, pair.end_marker_idx);
+            }
+            
+            if (path_index_from_id[pair.file_id] == max_u32)
+            {
+                String_Const_u8 path = loco_path_table.paths[pair.file_id];
+                path_index_from_id[pair.file_id] = path_count;
+                paths[path_count].offset = string_bytes;
+                paths[path_count].size = (u32)path.size;
+                path_count += 1;
+                string_bytes += (u32)path.size;
+            }
+            
+            Loco_Snapshot_File_Pair &record = pairs[pair_count++];
+            record.uid = pair.uid;
+            record.fingerprint = pair.fingerprint;
+            record.start = range.min;
+            record.end = range.max;
+            record.path_index = path_index_from_id[pair.file_id];
+            record.flags = pair.flags & (Loco_Pair_Flag_Dormant | Loco_Pair_Flag_Lazy);
+        }
+        
+        snapshots[s].pair_count = pair_count - snapshots[s].first_pair;
+    }
+    
+    // Names go after the paths in the string bytes.
+    s = 0;
+    for (Loco_Yeet_Snapshot *node = yeets_snapshots.first; node != 0; node = node->next, s++)
+    {
+        snapshots[s].name_offset = string_bytes;
+        snapshots[s].name_size = (u32)node->name.size;
+        string_bytes += (u32)node->name.size;
+    }
+    
+    u8 *strings = push_array(scratch, u8, string_bytes);
+    for (u32 id = 1; id < loco_path_table.count; id++)
+    {
+        u32 path_index = path_index_from_id[id];
+        if (path_index == max_u32) continue;
+        block_copy(strings + paths[path_index].offset, loco_path_table.paths[id].str, paths[path_index].size);
+    }
+    s = 0;
+    for (Loco_Yeet_Snapshot *node = yeets_snapshots.first; node != 0; node = node->next, s++)
+    {
+        block_copy(strings + snapshots[s].name_offset, node->name.str, node->name.size);
+    }
+    
+    Loco_Snapshot_File_View view = {};
+    view.header.path_count = path_count;
+    view.header.snapshot_count = snapshot_count;
+    view.header.pair_count = pair_count;
+    view.header.string_bytes = string_bytes;
+    view.paths = paths;
+    view.snapshots = snapshots;
+    view.pairs = pairs;
+    view.strings = strings;
+    String_Const_u8 image = loco_snapshot_file_pack(scratch, &view);
+    
+    String_Const_u8 file_path = loco_yeet_data_file_path(scratch, loco_yeet_snapshot_file_name);
+    FILE *file = fopen((char*)file_path.str, "wb");
+    if (file == 0) return false;
+    bool success = (fwrite(image.str, 1, image.size, file) == image.size);
+    fclose(file);
+    return success;
+}
+
+//~ @snapshot @pairtable
+// Every place that holds a pair table: each sheet's live table and history versions, then
+// every snapshot. out_sheets gives the sheet for a live table and 0 for the others. The
+// same table can be in several places.
+static Loco_Pair_Table***
+loco_get_every_pair_table(Application_Links *app, Arena *arena, Buffer_ID **out_sheets, i32 *count)
+{
+    Loco_Buffer_Set *sheets = &loco_yeet_sheets.buffers;
+    i32 max_count = yeets_snapshots.count;
+    for (i32 s = 0; s < sheets->count; s++)
+    {
+        Loco_Yeet_History *history = &loco_get_yeet_sheet(app, sheets->ids[s])->history;
+        max_count += 1 + history->undo_count + history->redo_count;
+    }
+    Loco_Pair_Table ***tables = push_array(arena, Loco_Pair_Table**, max_count);
+    Buffer_ID *live_sheets = push_array_zero(arena, Buffer_ID, max_count);
+    *count = 0;
+    for (i32 s = 0; s < sheets->count; s++)
+    {
+        Loco_Yeet_History *history = &loco_get_yeet_sheet(app, sheets->ids[s])->history;
+        live_sheets[*count] = sheets->ids[s];
+        tables[(*count)++] = loco_get_yeet_pair_table(app, sheets->ids[s]);
+        for (i32 i = 0; i < history->undo_count; i++) tables[(*count)++] = &history->undo[i];
+        for (i32 i = 0; i < history->redo_count; i++) tables[(*count)++] = &history->redo[i];
+    }
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        tables[(*count)++] = &snapshot->table;
+    }
+    *out_sheets = live_sheets;
+    return tables;
+}
+
+//~ @snapshot @pairtable
+// Copies of the pairs of every sheet, every snapshot and every history version. A pair
+// shared by several tables shows up once per table.
+static Loco_Marker_Pair*
+loco_get_every_pair(Application_Links *app, Arena *arena, i32 *count)
+{
+    Buffer_ID *live_sheets = 0;
+    i32 tables_count = 0;
+    Loco_Pair_Table ***tables = loco_get_every_pair_table(app, arena, &live_sheets, &tables_count);
+    i32 max_count = 0;
+    for (i32 t = 0; t < tables_count; t++)
+    {
+        if (*tables[t] != 0) max_count += (*tables[t])->pairs_count;
+    }
+    Loco_Marker_Pair *pairs = push_array(arena, Loco_Marker_Pair, max_count);
+    *count = 0;
+    for (i32 t = 0; t < tables_count; t++)
+    {
+        Loco_Yeets yeets = loco_pair_table_flatten(arena, *tables[t]);
+        block_copy(pairs + *count, yeets.pairs, sizeof(Loco_Marker_Pair)*yeets.pairs_count);
+        *count += yeets.pairs_count;
+    }
+    return pairs;
+}
+
+//~ @snapshot @pairtable
+// Gives every copy of a pair in source_from_uid its new source side and flags, in the
+// live tables, the history and the snapshots. Tables are copy-on-write: a table holding
+// such a pair is rebuilt sharing its other chunks, and a table found in several places
+// is rebuilt once.
+static void
+loco_set_every_pair_source(Application_Links *app, Table_u64_u64 *source_from_uid, Loco_Pair_Source *sources,
+                           u32 set_flags, u32 clear_flags)
+{
+    Scratch_Block scratch(app);
+    Buffer_ID *live_sheets = 0;
+    i32 tables_count = 0;
+    Loco_Pair_Table ***tables = loco_get_every_pair_table(app, scratch, &live_sheets, &tables_count);
+    // Old tables are released at the end, so a freed table's address can't be handed out
+    // again while it is still a key here.
+    Loco_Pair_Table **old_tables = push_array(scratch, Loco_Pair_Table*, tables_count);
+    Table_u64_u64 new_from_old = make_table_u64_u64(get_base_allocator_system(), tables_count*2 + 8);
+    i32 old_count = 0;
+    for (i32 t = 0; t < tables_count; t++)
+    {
+        Loco_Pair_Table *table = *tables[t];
+        if (table == 0) continue;
+        
+        u64 new_table = 0;
+        if (table_read(&new_from_old, (u64)table, &new_table))
+        {
+            loco_pair_table_retain((Loco_Pair_Table*)new_table);
+        }
+        else
+        {
+            Temp_Memory temp = begin_temp(scratch);
+            Loco_Yeets yeets = loco_pair_table_flatten(scratch, table);
+            bool any_changed = false;
+            for (i32 i = 0; i < yeets.pairs_count; i++)
+            {
+                Loco_Marker_Pair &pair = yeets.pairs[i];
+                u64 source_idx = 0;
+                if (!table_read(source_from_uid, pair.uid, &source_idx)) continue;
+                Loco_Pair_Source source = sources[source_idx];
+                pair.buffer = source.buffer;
+                pair.start_marker_idx = source.start_marker_idx;
+                pair.end_marker_idx = source.end_marker_idx;
+                pair.dormant_range = source.dormant_range;
+                pair.fingerprint = source.fingerprint;
+                pair.flags = (pair.flags & ~clear_flags) | set_flags;
+                any_changed = true;
+            }
+            new_table = (u64)(any_changed ? loco_pair_table_make(yeets.pairs, yeets.pairs_count, table) : loco_pair_table_retain(table));
+            end_temp(temp);
+            table_insert(&new_from_old, (u64)table, new_table);
+        }
+        
+        if (live_sheets[t] != 0) loco_reindex_sheet_sources(app, live_sheets[t], table, (Loco_Pair_Table*)new_table);
+        *tables[t] = (Loco_Pair_Table*)new_table;
+        old_tables[old_count++] = table;
+    }
+    table_free(&new_from_old);
+    for (i32 i = 0; i < old_count; i++) loco_pair_table_release(old_tables[i]);
+}
+
+//~ @persist @marker
+// Remembers that a file has dormant pairs, see loco_bind_dormant_pairs.
+static void
+loco_mark_file_dormant(u32 file_id)
+{
+    if (file_id != 0 && loco_path_table.is_initialized)
+    {
+        table_insert(&loco_path_table.dormant_ids, file_id, 1);
+    }
+}
+
+//~ @persist @snapshot @marker
+// Gives every dormant pair, live or in a snapshot, that belongs to this buffer's file a
+// pair of markers. Files without dormant pairs return after one lookup. Copies of a pair
+// share their markers. Pairs whose text changed while the file was closed keep their
+// old fingerprint and are searched for on the next tick.
+static void
+loco_bind_dormant_pairs(Application_Links *app, Buffer_ID buffer)
+{
+    Scratch_Block scratch(app);
+    u32 file_id = loco_find_path_id(push_buffer_file_name(app, scratch, buffer));
+    if (file_id == 0) return;
+    u64 has_dormant = 0;
+    if (!table_read(&loco_path_table.dormant_ids, file_id, &has_dormant)) return;
+    table_erase(&loco_path_table.dormant_ids, file_id);
+    
+    i32 every_pairs_count = 0;
+    Loco_Marker_Pair *every_pairs = loco_get_every_pair(app, scratch, &every_pairs_count);
+    u32 dormant_count = 0;
+    for (i32 i = 0; i < every_pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = every_pairs[i];
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant) && pair.file_id == file_id) dormant_count += 1;
+    }
+    if (dormant_count == 0) return;
+    
+    Table_u64_u64 source_from_uid = make_table_u64_u64(get_base_allocator_system(), dormant_count*2);
+    Marker *new_markers = push_array(scratch, Marker, dormant_count*2);
+    Loco_Pair_Source *sources = push_array(scratch, Loco_Pair_Source, dormant_count);
+    i32 new_markers_count = 0;
+    i32 drifted_count = 0;
+    i64 buffer_size = buffer_get_size(app, buffer);
+    
+    // One marker pair per uid.
+    for (i32 i = 0; i < every_pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = every_pairs[i];
+        if (!HasFlag(pair.flags, Loco_Pair_Flag_Dormant) || pair.file_id != file_id) continue;
+        
+        u64 existing = 0;
+        if (table_read(&source_from_uid, pair.uid, &existing)) continue;
+        
+        Range_i64 range = pair.dormant_range;
+        range.min = clamp_top(clamp_bot(range.min, 0), buffer_size);
+        range.max = clamp_top(clamp_bot(range.max, range.min), buffer_size);
+        // A block that still matches gets a fresh fingerprint.
+        Loco_Fingerprint fingerprint = loco_fingerprint_buffer_range(app, buffer, range);
+        if (fingerprint.content_hash != pair.fingerprint.content_hash)
+        {
+            drifted_count += 1;
+            fingerprint = pair.fingerprint;
+        }
+        Loco_Pair_Source &source = sources[new_markers_count/2];
+        source.buffer = buffer;
+        source.start_marker_idx = new_markers_count;
+        source.end_marker_idx = new_markers_count + 1;
+        source.dormant_range = pair.dormant_range;
+        source.fingerprint = fingerprint;
+        
+        table_insert(&source_from_uid, pair.uid, (u64)new_markers_count/2);
+        new_markers[new_markers_count].pos = range.min;
+        new_markers[new_markers_count].lean_right = false;
+        new_markers[new_markers_count + 1].pos = range.max;
+        new_markers[new_markers_count + 1].lean_right = true;
+        new_markers_count += 2;
+    }
+    
+    i32 first_marker_idx = loco_append_markers(app, buffer, new_markers, new_markers_count);
+    for (i32 k = 0; k < new_markers_count/2; k++)
+    {
+        sources[k].start_marker_idx += first_marker_idx;
+        sources[k].end_marker_idx += first_marker_idx;
+    }
+    
+    // The file may have changed while it was closed, the verify hashes are of the old text.
+    // The sheets that get pairs back hear about this buffer's edits again.
+    loco_set_every_pair_source(app, &source_from_uid, sources, 0, Loco_Pair_Flag_Dormant | Loco_Pair_Flag_Hashed);
+    table_free(&source_from_uid);
+    
+    if (drifted_count > 0)
+    {
+        // The yeet blocks still show the old text, re-anchoring refreshes the ones it finds.
+        loco_anchor_mark_lost(app, buffer);
+        String_Const_u8 message = push_u8_stringf(scratch, "yeet: %d ranges in %.*s changed while the file was closed.\n", drifted_count, string_expand(loco_path_from_id(file_id)));
+        print_message(app, message);
+    }
+}
+
+//~ @persist @snapshot
+// Reads the snapshot file with one read and replaces the snapshots with its contents.
+// Pairs start dormant and are bound straight away for files that are already open.
+static void
+loco_read_yeet_snapshots_file(Application_Links *app)
+{
+    loco_yeet_snapshot_file_loaded = true;
+    
+    Scratch_Block scratch(app);
+    String_Const_u8 file_path = loco_yeet_data_file_path(scratch, loco_yeet_snapshot_file_name);
+    FILE *file = fopen((char*)file_path.str, "rb");
+    if (file == 0) return;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8 *image = 0;
+    bool read_ok = false;
+    if (file_size >= (long)sizeof(Loco_Snapshot_File_Header))
+    {
+        image = push_array(scratch, u8, file_size);
+        read_ok = (fread(image, 1, file_size, file) == (size_t)file_size);
+    }
+    fclose(file);
+    if (!read_ok) return;
+    
+    Loco_Snapshot_File_View view = {};
+    if (!loco_snapshot_file_unpack(image, (u64)file_size, &view)) return;
+    Loco_Snapshot_File_Header *header = &view.header;
+    Loco_Snapshot_File_Path *paths = view.paths;
+    Loco_Snapshot_File_Snapshot *snapshots = view.snapshots;
+    Loco_Snapshot_File_Pair *pairs = view.pairs;
+    u8 *strings = view.strings;
+    
+    u32 *file_id_from_path = push_array(scratch, u32, header->path_count);
+    for (u32 i = 0; i < header->path_count; i++)
+    {
+        if ((u64)paths[i].offset + paths[i].size > header->string_bytes) return;
+        file_id_from_path[i] = loco_intern_path(SCu8(strings + paths[i].offset, paths[i].size));
+    }
+    
+    loco_free_yeet_snapshots();
+    Loco_Marker_Pair *snapshot_pairs = push_array(scratch, Loco_Marker_Pair, header->pair_count);
+    Loco_Pair_Table *prev_table = 0;
+    for (u32 s = 0; s < header->snapshot_count; s++)
+    {
+        Loco_Snapshot_File_Snapshot entry = snapshots[s];
+        if ((u64)entry.first_pair + entry.pair_count > header->pair_count) continue;
+        if ((u64)entry.name_offset + entry.name_size > header->string_bytes) continue;
+        
+        i32 snapshot_pairs_count = 0;
+        for (u32 i = 0; i < entry.pair_count; i++)
+        {
+            Loco_Snapshot_File_Pair *record = &pairs[entry.first_pair + i];
+            if (record->path_index >= header->path_count) continue;
+            
+            Loco_Marker_Pair &pair = snapshot_pairs[snapshot_pairs_count];
+            block_zero_struct(&pair);
+            // Only the order matters for the yeet markers until the snapshot is loaded.
+            pair.yeet_start_marker_idx = snapshot_pairs_count*2;
+            pair.yeet_end_marker_idx = pair.yeet_start_marker_idx + 1;
+            pair.file_id = file_id_from_path[record->path_index];
+            pair.flags = Loco_Pair_Flag_Dormant | (record->flags & Loco_Pair_Flag_Lazy);
+            pair.uid = record->uid;
+            pair.dormant_range = Ii64(record->start, record->end);
+            pair.fingerprint = record->fingerprint;
+            if (pair.uid >= loco_yeet_next_uid) loco_yeet_next_uid = pair.uid + 1;
+            loco_mark_file_dormant(pair.file_id);
+            snapshot_pairs_count += 1;
+        }
+        
+        // Snapshots saved one after another tend to start with the same pairs,
+        // so share what we can with the previous one.
+        String_Const_u8 name = SCu8(strings + entry.name_offset, entry.name_size);
+        Loco_Yeet_Snapshot *snapshot = loco_get_or_make_yeet_snapshot(name);
+        loco_pair_table_release(snapshot->table);
+        snapshot->table = loco_pair_table_make(snapshot_pairs, snapshot_pairs_count, prev_table);
+        prev_table = snapshot->table;
+    }
+    
+    for (Buffer_ID buffer = get_buffer_next(app, 0, Access_Always);
+         buffer != 0;
+         buffer = get_buffer_next(app, buffer, Access_Always))
+    {
+        loco_bind_dormant_pairs(app, buffer);
+    }
+}
+
+//~ @persist @snapshot
+static void
+loco_ensure_yeet_snapshots_file_loaded(Application_Links *app)
+{
+    if (!loco_yeet_snapshot_file_loaded)
+    {
+        loco_read_yeet_snapshots_file(app);
+    }
+}
+
+//~ @persist @snapshot
+// Called while a buffer is closing, its markers are still readable. Pairs from a file,
+// live or in a snapshot, remember their range and fingerprint and go dormant instead
+// of being dropped. Returns true if any pair changed.
+static bool
+loco_make_pairs_dormant(Application_Links *app, Buffer_ID buffer)
+{
+    Scratch_Block scratch(app);
+    i32 markers_count = 0;
+    Marker *markers = loco_get_buffer_markers(app, scratch, buffer, &markers_count);
+    i32 every_pairs_count = 0;
+    Loco_Marker_Pair *every_pairs = loco_get_every_pair(app, scratch, &every_pairs_count);
+    Table_u64_u64 source_from_uid = make_table_u64_u64(get_base_allocator_system(), 64);
+    Loco_Pair_Source *sources = push_array(scratch, Loco_Pair_Source, every_pairs_count);
+    i32 sources_count = 0;
+    for (i32 i = 0; i < every_pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = every_pairs[i];
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant) || pair.buffer != buffer || pair.file_id == 0) continue;
+        u64 existing = 0;
+        if (table_read(&source_from_uid, pair.uid, &existing)) continue;
+        
+        Loco_Pair_Source &source = sources[sources_count];
+        source.buffer = 0;
+        source.start_marker_idx = pair.start_marker_idx;
+        source.end_marker_idx = pair.end_marker_idx;
+        source.dormant_range = pair.dormant_range;
+        source.fingerprint = pair.fingerprint;
+        if (pair.end_marker_idx < markers_count)
+        {
+            source.dormant_range = loco_make_range_from_markers(markers, pair.start_marker_idx, pair.end_marker_idx);
+            source.fingerprint = loco_fingerprint_buffer_range(app, buffer, source.dormant_range);
+        }
+        table_insert(&source_from_uid, pair.uid, (u64)sources_count);
+        sources_count += 1;
+        loco_mark_file_dormant(pair.file_id);
+    }
+    if (sources_count > 0)
+    {
+        loco_set_every_pair_source(app, &source_from_uid, sources, Loco_Pair_Flag_Dormant, 0);
+    }
+    table_free(&source_from_uid);
+    return (sources_count > 0);
+}
+
+//--NEST-INDEX
+
+// @nestindex @yeettype
+enum Loco_Nest_Kind
+{
+    Loco_Nest_Kind_Other,
+    Loco_Nest_Kind_Function,
+    Loco_Nest_Kind_Struct,
+    Loco_Nest_Kind_Namespace
+};
+
+// @nestindex @yeettype
+struct Loco_Nest
+{
+    // From the open brace to one past the close brace.
+    Range_i64 range;
+    // Start of the declaration the scope belongs to, including the comments directly above it.
+    i64 decl_start;
+    Loco_Nest_Kind kind;
+};
+
+// @nestindex @yeettype
+struct Loco_Nest_Node
+{
+    Loco_Nest_Node *next;
+    Loco_Nest nest;
+};
+
+// @nestindex @yeettype
+// The declaration level scopes of a buffer, i.e. the outermost scopes that are not
+// namespaces (scopes inside a namespace or extern "C" block still count).
+// They never overlap so they are kept sorted by position and found with a binary search.
+// Built from the token array once, then shifted on edits, and rebuilt only when an
+// edit touches a brace.
+struct Loco_Nest_Index
+{
+    Arena arena;
+    bool has_arena;
+    bool is_valid;
+    Loco_Nest *nests;
+    i32 nests_count;
+};
+
+//~ @nestindex
+// Returns true if a whitespace token holds a blank line, which detaches a comment
+// from the declaration after it.
+static bool
+loco_whitespace_has_blank_line(Application_Links *app, Buffer_ID buffer, Token *tok)
+{
+    u8 window[256];
+    i32 newline_count = 0;
+    i64 end = tok->pos + tok->size;
+    for (i64 chunk_start = tok->pos; chunk_start < end; chunk_start += sizeof(window))
+    {
+        i64 chunk_end = chunk_start + sizeof(window);
+        if (chunk_end > end) chunk_end = end;
+        if (!buffer_read_range(app, buffer, Ii64(chunk_start, chunk_end), window)) return false;
+        for (i64 i = 0; i < chunk_end - chunk_start; i++)
+        {
+            if (window[i] == '\n') newline_count += 1;
+            if (newline_count >= 2) return true;
+        }
+    }
+    return false;
+}
+
+//~ @nestindex
+// Single pass over the token array.
+static void
+loco_nest_index_build(Application_Links *app, Buffer_ID buffer, Loco_Nest_Index *index)
+{
+    if (!index->has_arena)
+    {
+        index->arena = make_arena_system();
+        index->has_arena = true;
+    }
+    linalloc_clear(&index->arena);
+    index->nests = 0;
+    index->nests_count = 0;
+    index->is_valid = false;
+    
+    Token_Array token_arr = get_token_array_from_buffer(app, buffer);
+    if (token_arr.tokens == 0) return;
+    
+    Scratch_Block scratch(app);
+    Loco_Nest_Node *first_node = 0;
+    Loco_Nest_Node *last_node = 0;
+    i32 nests_count = 0;
+    
+    // Declaration state, only tracked while not inside a declaration level scope.
+    i64 comment_start = -1;
+    i64 decl_start = -1;
+    bool saw_paren = false;
+    bool saw_record = false;
+    bool saw_namespace = false;
+    bool saw_extern = false;
+    bool saw_eq = false;
+    
+    i64 namespace_depth = 0;
+    i64 inner_depth = 0;
+    Loco_Nest current = {};
+    
+    Token_Iterator_Array it = token_iterator_index(buffer, &token_arr, 0);
+    for(Token* tok = token_it_read(&it);
+        tok != 0;
+        tok = token_it_read(&it))
+    {
+        if (inner_depth > 0)
+        {
+            if (HasFlag(tok->flags, TokenBaseFlag_PreprocessorBody))
+            {
+                // Braces in macro bodies don't count.
+            }
+            else if (tok->sub_kind == TokenCppKind_BraceOp)
+            {
+                inner_depth += 1;
+            }
+            else if (tok->sub_kind == TokenCppKind_BraceCl)
+            {
+                inner_depth -= 1;
+                if (inner_depth == 0)
+                {
+                    current.range.max = tok->pos + 1;
+                    Loco_Nest_Node *node = push_array(scratch, Loco_Nest_Node, 1);
+                    node->nest = current;
+                    sll_queue_push(first_node, last_node, node);
+                    nests_count += 1;
+                    comment_start = decl_start = -1;
+                    saw_paren = saw_record = saw_namespace = saw_extern = saw_eq = false;
+                }
+            }
+        }
+        else if (tok->kind == TokenBaseKind_Whitespace)
+        {
+            if (comment_start >= 0 && decl_start < 0 && loco_whitespace_has_blank_line(app, buffer, tok))
+            {
+                comment_start = -1;
+            }
+        }
+        else if (tok->kind == TokenBaseKind_Comment)
+        {
+            if (comment_start < 0 && decl_start < 0) comment_start = tok->pos;
+        }
+        else if (tok->kind == TokenBaseKind_Preprocessor || HasFlag(tok->flags, TokenBaseFlag_PreprocessorBody))
+        {
+            comment_start = decl_start = -1;
+            saw_paren = saw_record = saw_namespace = saw_extern = saw_eq = false;
+        }
+        else if (tok->sub_kind == TokenCppKind_BraceOp)
+        {
+            Loco_Nest_Kind kind = Loco_Nest_Kind_Other;
+            if (saw_namespace || (saw_extern && !saw_paren)) kind = Loco_Nest_Kind_Namespace;
+            else if (saw_record) kind = Loco_Nest_Kind_Struct;
+            else if (saw_paren && !saw_eq) kind = Loco_Nest_Kind_Function;
+            
+            if (kind == Loco_Nest_Kind_Namespace)
+            {
+                namespace_depth += 1;
+                comment_start = decl_start = -1;
+                saw_paren = saw_record = saw_namespace = saw_extern = saw_eq = false;
+            }
+            else
+            {
+                current.kind = kind;
+                current.range.min = tok->pos;
+                current.decl_start = tok->pos;
+                if (decl_start >= 0) current.decl_start = decl_start;
+                if (comment_start >= 0) current.decl_start = comment_start;
+                inner_depth = 1;
+            }
+        }
+        else if (tok->sub_kind == TokenCppKind_BraceCl)
+        {
+            if (namespace_depth > 0) namespace_depth -= 1;
+            comment_start = decl_start = -1;
+            saw_paren = saw_record = saw_namespace = saw_extern = saw_eq = false;
+        }
+        else if (tok->sub_kind == TokenCppKind_Semicolon)
+        {
+            comment_start = decl_start = -1;
+            saw_paren = saw_record = saw_namespace = saw_extern = saw_eq = false;
+        }
+        else
+        {
+            if (decl_start < 0) decl_start = tok->pos;
+            switch (tok->sub_kind)
+            {
+                case TokenCppKind_ParenCl: { saw_paren = true; } break;
+                case TokenCppKind_Eq: { saw_eq = true; } break;
+                case TokenCppKind_Namespace: { saw_namespace = true; } break;
+                case TokenCppKind_Extern: { saw_extern = true; } break;
+                case TokenCppKind_Struct:
+                case TokenCppKind_Union:
+                case TokenCppKind_Class:
+                case TokenCppKind_Enum: { saw_record = true; } break;
+            }
+        }
+        
+        if (!token_it_inc_all(&it)) break;
+    }
+    
+    index->nests_count = nests_count;
+    index->nests = push_array(&index->arena, Loco_Nest, nests_count);
+    i32 i = 0;
+    for (Loco_Nest_Node *node = first_node; node != 0; node = node->next)
+    {
+        index->nests[i++] = node->nest;
+    }
+    index->is_valid = true;
+}
+
+//~ @nestindex
+static Loco_Nest_Index*
+loco_get_nest_index(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    Loco_Nest_Index *index = scope_attachment(app, scope, loco_nest_index_handle, Loco_Nest_Index);
+    if (index != 0 && !index->is_valid)
+    {
+        loco_nest_index_build(app, buffer, index);
+    }
+    return index;
+}
+
+//~ @nestindex
+// Index of the last nest that starts at or before pos, or -1.
+static i32
+loco_nest_index_search(Loco_Nest_Index *index, i64 pos)
+{
+    i32 lo = 0;
+    i32 hi = index->nests_count;
+    while (lo < hi)
+    {
+        i32 mid = (lo + hi)/2;
+        if (index->nests[mid].range.min <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+//~ @nestindex
+// The cached braces must still be braces in the current token array and still close each
+// other, otherwise an edit changed the lexing (e.g. a comment or string was opened) or
+// deleted a brace inside the scope, and the index has to be rebuilt. Costs a walk over
+// the scope's tokens.
+static bool
+loco_nest_is_still_valid(Token_Array *token_arr, Loco_Nest *nest)
+{
+    if (token_arr->tokens == 0 || token_arr->count == 0) return false;
+    i64 open_idx = token_index_from_pos(token_arr, (u64)nest->range.min);
+    i64 close_idx = token_index_from_pos(token_arr, (u64)(nest->range.max - 1));
+    if (open_idx < 0 || open_idx >= token_arr->count || close_idx < 0 || close_idx >= token_arr->count) return false;
+    Token *open = token_arr->tokens + open_idx;
+    Token *close = token_arr->tokens + close_idx;
+    if (!(open->pos == nest->range.min && open->sub_kind == TokenCppKind_BraceOp &&
+          close->pos == nest->range.max - 1 && close->sub_kind == TokenCppKind_BraceCl))
+    {
+        return false;
+    }
+    i32 depth = 0;
+    for (i64 i = open_idx; i < close_idx; i++)
+    {
+        Token *token = token_arr->tokens + i;
+        if (token->sub_kind == TokenCppKind_BraceOp) depth += 1;
+        else if (token->sub_kind == TokenCppKind_BraceCl) depth -= 1;
+        if (depth <= 0) return false;
+    }
+    return (depth == 1);
+}
+
+//~ @nestindex
+// Finds the outermost non-namespace scope containing pos. O(log n) once the index is built.
+static bool
+loco_nest_index_find(Application_Links *app, Buffer_ID buffer, i64 pos, Loco_Nest *out_nest)
+{
+    Loco_Nest_Index *index = loco_get_nest_index(app, buffer);
+    if (index == 0 || !index->is_valid) return false;
+    
+    Token_Array token_arr = get_token_array_from_buffer(app, buffer);
+    for (i32 attempt = 0; attempt < 2; attempt++)
+    {
+        i32 i = loco_nest_index_search(index, pos);
+        if (i < 0 || pos > index->nests[i].range.max) return false;
+        if (loco_nest_is_still_valid(&token_arr, &index->nests[i]))
+        {
+            *out_nest = index->nests[i];
+            return true;
+        }
+        loco_nest_index_build(app, buffer, index);
+        if (!index->is_valid) return false;
+    }
+    return false;
+}
+
+//~ @nestindex
+// Makes sure every cached scope still matches the token array, rebuilding once if not.
+// Used by commands that walk the whole index rather than looking up one position.
+static Loco_Nest_Index*
+loco_nest_index_refresh(Application_Links *app, Buffer_ID buffer)
+{
+    Loco_Nest_Index *index = loco_get_nest_index(app, buffer);
+    if (index == 0 || !index->is_valid) return index;
+    
+    Token_Array token_arr = get_token_array_from_buffer(app, buffer);
+    for (i32 i = 0; i < index->nests_count; i++)
+    {
+        if (!loco_nest_is_still_valid(&token_arr, &index->nests[i]))
+        {
+            loco_nest_index_build(app, buffer, index);
+            break;
+        }
+    }
+    return index;
+}
+
+//~ @nestindex
+// The range to yeet for a scope: from the start of the line its declaration starts on.
+static Range_i64
+loco_nest_yeet_range(Application_Links *app, Buffer_ID buffer, Loco_Nest *nest)
+{
+    i64 start_line = get_line_number_from_pos(app, buffer, nest->decl_start);
+    return Ii64(get_line_start_pos(app, buffer, start_line), nest->range.max);
+}
+
+//~ @nestindex @edit
+// Moves a cached position through an edit. Positions inside the replaced text
+// collapse to the start of the edit.
+static i64
+loco_shift_pos_for_edit(i64 pos, Range_i64 old_range, i64 shift)
+{
+    if (pos >= old_range.max) return pos + shift;
+    if (pos > old_range.min) return old_range.min;
+    return pos;
+}
+
+//~ @nestindex @edit
+static void
+loco_nest_index_on_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
+    Loco_Nest_Index *index = scope_attachment(app, scope, loco_nest_index_handle, Loco_Nest_Index);
+    if (index == 0 || !index->is_valid) return;
+    
+    // The deleted text can't be seen here. Inside a scope's braces, loco_nest_is_still_valid
+    // catches a deleted brace when the scope is looked up, but between scopes a deleted brace
+    // or comment opener can make a new scope, so the tree is rebuilt.
+    i32 containing = loco_nest_index_search(index, old_range.min);
+    bool is_interior = (containing >= 0 &&
+                        index->nests[containing].range.min < old_range.min &&
+                        old_range.max < index->nests[containing].range.max);
+    if (!is_interior && old_range.min < old_range.max)
+    {
+        index->is_valid = false;
+        return;
+    }
+    
+    // New braces change the tree, between scopes so can text that opens or closes a comment
+    // or string. Big insertions aren't worth scanning.
+    i64 insert_size = range_size(new_range);
+    if (insert_size > KB(4))
+    {
+        index->is_valid = false;
+        return;
+    }
+    u8 inserted[KB(4)];
+    if (insert_size > 0 && buffer_read_range(app, buffer_id, new_range, inserted))
+    {
+        for (i64 i = 0; i < insert_size; i++)
+        {
+            u8 c = inserted[i];
+            bool changes_lexing = (c == '/' || c == '*' || c == '"' || c == '\'' || c == '#');
+            if (c == '{' || c == '}' || (!is_interior && changes_lexing))
+            {
+                index->is_valid = false;
+                return;
+            }
+        }
+    }
+    
+    i64 text_shift = replace_range_shift(old_range, insert_size);
+    i32 first = loco_nest_index_search(index, old_range.min);
+    if (first < 0) first = 0;
+    for (i32 i = first; i < index->nests_count; i++)
+    {
+        Loco_Nest &nest = index->nests[i];
+        if (nest.range.max <= old_range.min) continue;
+        
+        // A deleted brace changes the tree.
+        if (old_range.min < old_range.max &&
+            ((nest.range.min >= old_range.min && nest.range.min < old_range.max) ||
+             (nest.range.max - 1 >= old_range.min && nest.range.max - 1 < old_range.max)))
+        {
+            index->is_valid = false;
+            return;
+        }
+        
+        nest.decl_start = loco_shift_pos_for_edit(nest.decl_start, old_range, text_shift);
+        nest.range.min = loco_shift_pos_for_edit(nest.range.min, old_range, text_shift);
+        nest.range.max = loco_shift_pos_for_edit(nest.range.max, old_range, text_shift);
+    }
+}
+
+//~ @nestindex
+static void
+loco_nest_index_free(Application_Links *app, Buffer_ID buffer_id)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
+    Loco_Nest_Index *index = scope_attachment(app, scope, loco_nest_index_handle, Loco_Nest_Index);
+    if (index != 0 && index->has_arena)
+    {
+        linalloc_clear(&index->arena);
+        block_zero_struct(index);
+    }
+}
+
+//~ @lines
+static void
+loco_line_table_reserve(Loco_Line_Table *table, i64 count)
+{
+    if (count <= table->cap) return;
+    Base_Allocator *allocator = get_base_allocator_system();
+    i64 new_cap = Max(table->cap*2 + 256, count);
+    i64 *new_starts = (i64*)base_allocate(allocator, sizeof(i64)*new_cap).data;
+    block_copy(new_starts, table->starts, sizeof(i64)*table->count);
+    if (table->starts != 0) base_free(allocator, table->starts);
+    table->starts = new_starts;
+    table->cap = new_cap;
+}
+
+//~ @lines
+static void
+loco_line_table_push(Loco_Line_Table *table, i64 start)
+{
+    loco_line_table_reserve(table, table->count + 1);
+    table->starts[table->count++] = start;
+}
+
+//~ @lines
+// Index of the last line start at or before pos, searching forward from the line at from,
+// which must start at or before pos. Gallops, so close positions are found in a few steps.
+static i64
+loco_line_table_find(Loco_Line_Table *table, i64 pos, i64 from)
+{
+    i64 lo = from;
+    i64 hi = from + 1;
+    i64 step = 1;
+    while (hi < table->count && table->starts[hi] <= pos)
+    {
+        lo = hi;
+        hi += step;
+        step *= 2;
+    }
+    hi = Min(hi, table->count);
+    // starts[lo] <= pos, and starts[hi] > pos or hi is the end.
+    while (lo + 1 < hi)
+    {
+        i64 mid = (lo + hi)/2;
+        if (table->starts[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+//~ @lines @edit
+// Moves the line starts through an edit: the starts in the replaced text are dropped, the
+// ones after it shifted, and only the new text is scanned. Big insertions drop the table
+// and it's built again on its next use.
+static void
+loco_line_table_on_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
+    Loco_Line_Table *table = scope_attachment(app, scope, loco_line_table_handle, Loco_Line_Table);
+    if (table == 0 || !table->is_built) return;
+    i64 insert_size = range_size(new_range);
+    if (insert_size > loco_yeet_sync_chunk_size)
+    {
+        table->is_built = false;
+        return;
+    }
+    
+    Scratch_Block scratch(app);
+    u8 *inserted = push_array(scratch, u8, insert_size);
+    if (insert_size > 0 && !buffer_read_range(app, buffer_id, new_range, inserted))
+    {
+        table->is_built = false;
+        return;
+    }
+    i64 added_count = 0;
+    for (i64 i = 0; i < insert_size; i++)
+    {
+        if (inserted[i] == '\n') added_count += 1;
+    }
+    
+    // The starts in (old_range.min, old_range.max] followed a deleted newline.
+    i64 first = loco_line_table_find(table, old_range.min, 0) + 1;
+    i64 last = loco_line_table_find(table, old_range.max, first - 1) + 1;
+    i64 tail_count = table->count - last;
+    i64 new_count = first + added_count + tail_count;
+    loco_line_table_reserve(table, new_count);
+    i64 shift = replace_range_shift(old_range, insert_size);
+    i64 *starts = table->starts;
+    if (first + added_count != last)
+    {
+        block_copy(starts + first + added_count, starts + last, sizeof(i64)*tail_count);
+    }
+    for (i64 i = first + added_count; i < new_count; i++) starts[i] += shift;
+    i64 at = first;
+    for (i64 i = 0; i < insert_size; i++)
+    {
+        if (inserted[i] == '\n') starts[at++] = new_range.min + i + 1;
+    }
+    table->count = new_count;
+}
+
+//~ @lines
+// The buffer's line table, scanning the buffer in chunks of loco_yeet_sync_chunk_size
+// when it isn't built yet.
+static Loco_Line_Table*
+loco_get_line_table(Application_Links *app, Buffer_ID buffer_id)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
+    Loco_Line_Table *table = scope_attachment(app, scope, loco_line_table_handle, Loco_Line_Table);
+    if (table->is_built) return table;
+    
+    table->count = 0;
+    loco_line_table_push(table, 0);
+    table->is_built = true;
+    Scratch_Block scratch(app);
+    i64 size = buffer_get_size(app, buffer_id);
+    i64 chunk_size = loco_yeet_sync_chunk_size;
+    u8 *chunk = push_array(scratch, u8, chunk_size);
+    for (i64 pos = 0; pos < size; pos += chunk_size)
+    {
+        i64 read_size = Min(chunk_size, size - pos);
+        if (!buffer_read_range(app, buffer_id, Ii64(pos, pos + read_size), chunk))
+        {
+            // Built again on the next use.
+            table->is_built = false;
+            break;
+        }
+        for (i64 i = 0; i < read_size; i++)
+        {
+            if (chunk[i] == '\n') loco_line_table_push(table, pos + i + 1);
+        }
+    }
+    return table;
+}
+
+//~ @lines
+static void
+loco_line_table_free(Application_Links *app, Buffer_ID buffer_id)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer_id);
+    Loco_Line_Table *table = scope_attachment(app, scope, loco_line_table_handle, Loco_Line_Table);
+    if (table != 0 && table->starts != 0)
+    {
+        base_free(get_base_allocator_system(), table->starts);
+        block_zero_struct(table);
+    }
+}
+
+//~ @lines @render
+// Line numbers for count positions of one buffer, like get_line_number_from_pos. The
+// positions are sorted and each is found by galloping on from the one before it, so
+// positions that are close together cost a few steps each.
+static void
+loco_get_line_numbers(Application_Links *app, Arena *arena, Buffer_ID buffer_id,
+                      i64 *positions, i64 *out_lines, i32 count)
+{
+    if (count == 0) return;
+    Loco_Line_Table *table = loco_get_line_table(app, buffer_id);
+    Temp_Memory temp = begin_temp(arena);
+    i32 *order = push_array(arena, i32, count);
+    for (i32 i = 0; i < count; i++) order[i] = i;
+    loco_sort_by_key_i64(arena, positions, order, count);
+    i64 line_idx = 0;
+    for (i32 i = 0; i < count; i++)
+    {
+        line_idx = loco_line_table_find(table, positions[order[i]], line_idx);
+        out_lines[order[i]] = line_idx + 1;
+    }
+    end_temp(temp);
+}
+
+//~ @lines @render
+// The source range and first and last line of every open pair of a sheet, out_lines
+// holding two per pair. Each source's markers are loaded and its lines resolved once,
+// however many of its blocks the sheet holds. Closed pairs get empty ranges.
+static void
+loco_get_pair_source_lines(Application_Links *app, Arena *arena, Loco_Yeets *yeets,
+                           Range_i64 *out_ranges, i64 *out_lines)
+{
+    i32 pairs_count = yeets->pairs_count;
+    Temp_Memory temp = begin_temp(arena);
+    b8 *is_done = push_array_zero(arena, b8, pairs_count);
+    i32 *group = push_array(arena, i32, pairs_count);
+    i64 *positions = push_array(arena, i64, pairs_count*2);
+    i64 *lines = push_array(arena, i64, pairs_count*2);
+    for (i32 i = 0; i < pairs_count; i++)
+    {
+        out_ranges[i] = Ii64(0, 0);
+        out_lines[i*2] = 0;
+        out_lines[i*2 + 1] = 0;
+    }
+    for (i32 i = 0; i < pairs_count; i++)
+    {
+        Buffer_ID buffer = yeets->pairs[i].buffer;
+        if (is_done[i] || HasFlag(yeets->pairs[i].flags, Loco_Pair_Flag_Dormant)) continue;
+        if (!buffer_exists(app, buffer)) continue;
+        
+        Temp_Memory group_temp = begin_temp(arena);
+        i32 markers_count = 0;
+        Marker *markers = loco_get_buffer_markers(app, arena, buffer, &markers_count);
+        i32 group_count = 0;
+        for (i32 j = i; j < pairs_count; j++)
+        {
+            Loco_Marker_Pair &pair = yeets->pairs[j];
+            if (is_done[j] || pair.buffer != buffer || HasFlag(pair.flags, Loco_Pair_Flag_Dormant)) continue;
+            is_done[j] = true;
+            if (pair.end_marker_idx >= markers_count) continue;
+            out_ranges[j] = loco_make_range_from_markers(markers, pair.start_marker_idx, pair.end_marker_idx);
+            positions[group_count*2] = out_ranges[j].min;
+            positions[group_count*2 + 1] = out_ranges[j].max;
+            group[group_count++] = j;
+        }
+        loco_get_line_numbers(app, arena, buffer, positions, lines, group_count*2);
+        for (i32 g = 0; g < group_count; g++)
+        {
+            out_lines[group[g]*2] = lines[g*2];
+            out_lines[group[g]*2 + 1] = lines[g*2 + 1];
+        }
+        end_temp(group_temp);
+    }
+    end_temp(temp);
+}
+
+//~ @sync
+static Loco_Dirty_Ranges*
+loco_get_pending_sync(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_pending_sync_handle, Loco_Dirty_Ranges);
+}
+
+//~ @verify
+static Loco_Dirty_Ranges*
+loco_get_verify_dirty(Application_Links *app, Buffer_ID buffer)
+{
+    Managed_Scope scope = buffer_get_managed_scope(app, buffer);
+    return scope_attachment(app, scope, loco_verify_dirty_handle, Loco_Dirty_Ranges);
+}
+
+//~ @sync @edit
+// Merges range i+1 into range i.
+static void
+loco_dirty_ranges_merge_next(Loco_Dirty_Ranges *dirty, i32 i)
+{
+    dirty->ranges[i] = range_union(dirty->ranges[i], dirty->ranges[i + 1]);
+    dirty->is_one_edit[i] = false;
+    for (i32 j = i + 1; j + 1 < dirty->count; j++)
+    {
+        dirty->ranges[j] = dirty->ranges[j + 1];
+        dirty->is_one_edit[j] = dirty->is_one_edit[j + 1];
+    }
+    dirty->count -= 1;
+}
+
+//~ @sync @edit
+// Moves the dirty ranges through an edit, and if is_dirty adds the new text. Ranges that
+// overlap or touch the new text, or each other after the edit, merge into one.
+// Returns true if there were no ranges before.
+static bool
+loco_dirty_range_note(Loco_Dirty_Ranges *dirty, Range_i64 old_range, Range_i64 new_range, bool is_dirty)
+{
+    bool was_empty = (dirty->count == 0);
+    if (was_empty && !is_dirty) return false;
+    
+    i64 shift = replace_range_shift(old_range, range_size(new_range));
+    for (i32 i = 0; i < dirty->count; i++)
+    {
+        Range_i64 &range = dirty->ranges[i];
+        if (range.min > old_range.min) range.min = (range.min >= old_range.max) ? range.min + shift : new_range.min;
+        if (range.max > old_range.min) range.max = (range.max >= old_range.max) ? range.max + shift : new_range.max;
+    }
+    
+    if (is_dirty)
+    {
+        // One is always kept free, see below.
+        i32 at = 0;
+        while (at < dirty->count && dirty->ranges[at].max < new_range.min) at += 1;
+        for (i32 j = dirty->count; j > at; j--)
+        {
+            dirty->ranges[j] = dirty->ranges[j - 1];
+            dirty->is_one_edit[j] = dirty->is_one_edit[j - 1];
+        }
+        dirty->ranges[at] = new_range;
+        dirty->is_one_edit[at] = true;
+        dirty->count += 1;
+    }
+    
+    for (i32 i = 0; i + 1 < dirty->count;)
+    {
+        if (dirty->ranges[i].max >= dirty->ranges[i + 1].min) loco_dirty_ranges_merge_next(dirty, i);
+        else i += 1;
+    }
+    if (dirty->count == ArrayCount(dirty->ranges))
+    {
+        // Keep one free for the next edit by merging the two closest.
+        i32 closest = 0;
+        for (i32 i = 1; i + 1 < dirty->count; i++)
+        {
+            if (dirty->ranges[i + 1].min - dirty->ranges[i].max <
+                dirty->ranges[closest + 1].min - dirty->ranges[closest].max) closest = i;
+        }
+        loco_dirty_ranges_merge_next(dirty, closest);
+    }
+    return was_empty;
+}
+
+//~ @sync
+// All of the dirty ranges as one range.
+static Range_i64
+loco_dirty_ranges_union(Loco_Dirty_Ranges *dirty)
+{
+    if (dirty->count == 0) return Ii64(0, 0);
+    return Ii64(dirty->ranges[0].min, dirty->ranges[dirty->count - 1].max);
+}
+
+//~ @sync
+// The dirty ranges that reach range, as one range from the first of them to the last.
+// Returns the index of the first, or -1 if none does, and how many do in out_count.
+static i32
+loco_dirty_ranges_at(Loco_Dirty_Ranges *dirty, Range_i64 range, Range_i64 *out_range, i32 *out_count)
+{
+    i32 first = -1;
+    i32 count = 0;
+    for (i32 i = 0; i < dirty->count; i++)
+    {
+        Range_i64 dirty_range = dirty->ranges[i];
+        if (dirty_range.max < range.min) continue;
+        if (dirty_range.min > range.max) break;
+        if (first < 0)
+        {
+            first = i;
+            *out_range = dirty_range;
+        }
+        out_range->max = dirty_range.max;
+        count += 1;
+    }
+    if (out_count != 0) *out_count = count;
+    return first;
+}
+
+//~ @sync @edit
+// Notes an edit on the buffer's pending dirty ranges, an edit the sync made itself only
+// moves them.
+static void
+loco_pending_sync_note(Application_Links *app, Buffer_ID buffer, Range_i64 old_range, Range_i64 new_range, bool is_dirty)
+{
+    if (loco_dirty_range_note(loco_get_pending_sync(app, buffer), old_range, new_range, is_dirty))
+    {
+        loco_buffer_set_add(&loco_yeet_pending_buffers, buffer);
+    }
+}
+
+//~ @sync
+// Classifies a dirty range against a block, see Loco_Block_Edit_Kind. An empty dirty range
+// (a deletion) at an empty block only touches its edge.
+static Loco_Block_Edit_Kind
+loco_classify_block_edit(Range_i64 block_range, Range_i64 dirty_range)
+{
+    if (dirty_range.max < block_range.min || block_range.max < dirty_range.min)
+    {
+        return Loco_Block_Edit_None;
+    }
+    if (range_size(dirty_range) > 0 &&
+        dirty_range.min <= block_range.min && block_range.max <= dirty_range.max)
+    {
+        return Loco_Block_Edit_Enclosing;
+    }
+    if (dirty_range.min < block_range.min || block_range.max < dirty_range.max)
+    {
+        return Loco_Block_Edit_Spanning;
+    }
+    if (dirty_range.min == block_range.min || dirty_range.max == block_range.max)
+    {
+        return Loco_Block_Edit_At_Edge;
+    }
+    return Loco_Block_Edit_Inside;
+}
+
+//~ @sync
+// The part of a block that a dirty range can have changed, in both copies of the block.
+// The text before and after the dirty range is the same in both, so only the middle is
+// compared and written. If the sizes say the copies drifted apart, the whole block is used.
+static void
+loco_get_block_edit_ranges(Range_i64 dirty_range, Range_i64 from_range, Range_i64 to_range,
+                           Range_i64 *out_from_edit_range, Range_i64 *out_to_edit_range)
+{
+    i64 prefix = clamp_bot(dirty_range.min - from_range.min, 0);
+    i64 suffix = clamp_bot(from_range.max - dirty_range.max, 0);
+    if (prefix + suffix > range_size(from_range) || prefix + suffix > range_size(to_range))
+    {
+        prefix = 0;
+        suffix = 0;
+    }
+    *out_from_edit_range = Ii64(from_range.min + prefix, from_range.max - suffix);
+    *out_to_edit_range = Ii64(to_range.min + prefix, to_range.max - suffix);
+}
+
+//~ @sync @lazy
+// The ranges of a sheet that its views showed on their last render, and their cursors.
+static Range_i64*
+loco_get_sheet_view_ranges(Application_Links *app, Arena *arena, Buffer_ID yeet_buffer, i32 *out_count)
+{
+    i32 views_count = 0;
+    for (View_ID view = get_view_next(app, 0, Access_Always);
+         view != 0;
+         view = get_view_next(app, view, Access_Always))
+    {
+        views_count += 1;
+    }
+    Range_i64 *ranges = push_array(arena, Range_i64, views_count*2);
+    i32 count = 0;
+    for (View_ID view = get_view_next(app, 0, Access_Always);
+         view != 0;
+         view = get_view_next(app, view, Access_Always))
+    {
+        if (view_get_buffer(app, view, Access_Always) != yeet_buffer) continue;
+        Managed_Scope view_scope = view_get_managed_scope(app, view);
+        ranges[count++] = *scope_attachment(app, view_scope, loco_view_visible_range_handle, Range_i64);
+        ranges[count++] = Ii64(view_get_cursor_pos(app, view));
+    }
+    *out_count = count;
+    return ranges;
+}
+
+//~ @buffer @edit @sync
+// Mirrors the dirty ranges of a source buffer into the blocks of one sheet that hold it,
+// with one batch edit. Each block is only compared against the dirty ranges that reach it.
+// The caller loads the source markers once for every sheet. Blocks whose text already
+// matches, like the one a sheet edit came from, aren't touched, and blocks that no view of
+// the sheet shows are only marked stale, so the cost of an edit is bounded by what is on
+// screen. Edits inside a block, at its edges or across one edge only copy the changed
+// middle. An edit that enclosed the block copies all of it, unless the block was deleted,
+// or one single edit enclosed it along with other blocks or the whole buffer (a reload),
+// then every block it holds has the same new text and has to be found again. Separate
+// edits that enclose separate blocks, like a multi-cursor edit, are copied as usual.
+static void
+loco_flush_source_edits(Application_Links *app, Buffer_ID buffer_id, Buffer_ID yeet_buffer,
+                        Marker *og_markers, i32 og_markers_count, Loco_Dirty_Ranges *dirty)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 yeet_markers_count = 0;
+    Marker* yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    i32 view_ranges_count = 0;
+    Range_i64 *view_ranges = loco_get_sheet_view_ranges(app, scratch, yeet_buffer, &view_ranges_count);
+    Batch_Edit *edits = push_array(scratch, Batch_Edit, yeets.pairs_count);
+    i32 *order = push_array(scratch, i32, yeets.pairs_count);
+    i64 *order_keys = push_array(scratch, i64, yeets.pairs_count);
+    i32 edits_count = 0;
+    bool any_lost = false;
+    bool any_near = false;
+    bool any_stale = false;
+    
+    // Which dirty ranges are one edit that replaced several blocks. Yeets of the same text
+    // share a content hash, they don't count as several.
+    Range_i64 all_dirty = loco_dirty_ranges_union(dirty);
+    i64 buffer_size = buffer_get_size(app, buffer_id);
+    b8 is_replaced[ArrayCount(dirty->ranges)] = {};
+    u64 enclosed_hash[ArrayCount(dirty->ranges)] = {};
+    b8 any_enclosed[ArrayCount(dirty->ranges)] = {};
+    for (i32 r = 0; r < dirty->count; r++)
+    {
+        is_replaced[r] = (dirty->is_one_edit[r] && dirty->ranges[r].min == 0 && dirty->ranges[r].max == buffer_size);
+    }
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = yeets.pairs[i];
+        if (pair.buffer != buffer_id || pair.end_marker_idx >= og_markers_count) continue;
+        Range_i64 og_range = loco_make_range_from_markers(
+                                                          og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        Range_i64 dirty_range = {};
+        i32 reach_count = 0;
+        i32 r = loco_dirty_ranges_at(dirty, og_range, &dirty_range, &reach_count);
+        if (r < 0 || reach_count != 1 || !dirty->is_one_edit[r]) continue;
+        if (loco_classify_block_edit(og_range, dirty_range) != Loco_Block_Edit_Enclosing) continue;
+        if (any_enclosed[r] && pair.fingerprint.content_hash != enclosed_hash[r]) is_replaced[r] = true;
+        enclosed_hash[r] = pair.fingerprint.content_hash;
+        any_enclosed[r] = true;
+    }
+    
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = yeets.pairs[i];
+        if (pair.buffer != buffer_id || pair.end_marker_idx >= og_markers_count) continue;
+        Range_i64 og_range = loco_make_range_from_markers(
+                                                          og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        Range_i64 near_range = Ii64(og_range.min - loco_yeet_anchor_context_bytes, og_range.max + loco_yeet_anchor_context_bytes);
+        Range_i64 near_dirty = {};
+        if (loco_dirty_ranges_at(dirty, near_range, &near_dirty, 0) < 0) continue;
+        any_near = true;
+        Range_i64 dirty_range = {};
+        i32 reach_count = 0;
+        i32 first_dirty = loco_dirty_ranges_at(dirty, og_range, &dirty_range, &reach_count);
+        Loco_Block_Edit_Kind kind = Loco_Block_Edit_None;
+        if (first_dirty >= 0)
+        {
+            kind = loco_classify_block_edit(og_range, dirty_range);
+        }
+        bool is_touched = (kind != Loco_Block_Edit_None);
+        
+        if (kind == Loco_Block_Edit_Enclosing && pair.fingerprint.content_size > 0 &&
+            ((reach_count == 1 && is_replaced[first_dirty]) || range_size(og_range) == 0))
+        {
+            any_lost = true;
+            continue;
+        }
+        
+        // A block being copied in chunks copies again from the first changed byte.
+        if (is_touched && HasFlag(pair.flags, Loco_Pair_Flag_Syncing))
+        {
+            loco_add_sync_job(yeet_buffer, pair.uid, clamp_bot(dirty_range.min - og_range.min, 0));
+        }
+        
+        // A placeholder picks up the current text when it's filled in.
+        if (!is_touched || HasFlag(pair.flags, Loco_Pair_Flag_Lazy)) continue;
+        if (pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        Range_i64 yeet_range = loco_make_range_from_markers(
+                                                            yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        bool is_seen = false;
+        for (i32 r = 0; r < view_ranges_count && !is_seen; r++)
+        {
+            is_seen = (yeet_range.min <= view_ranges[r].max && view_ranges[r].min <= yeet_range.max);
+        }
+        if (!is_seen)
+        {
+            pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+            any_stale = true;
+            continue;
+        }
+        Range_i64 og_edit_range = og_range;
+        Range_i64 yeet_edit_range = yeet_range;
+        if (kind != Loco_Block_Edit_Enclosing)
+        {
+            loco_get_block_edit_ranges(dirty_range, og_range, yeet_range, &og_edit_range, &yeet_edit_range);
+        }
+        if (range_size(og_edit_range) > loco_yeet_sync_chunk_size || range_size(yeet_edit_range) > loco_yeet_sync_chunk_size)
+        {
+            // Too big for one frame, loco_sync_jobs_tick copies it from where the edit starts.
+            pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Syncing;
+            loco_add_sync_job(yeet_buffer, pair.uid, og_edit_range.min - og_range.min);
+            any_stale = true;
+            continue;
+        }
+        String_Const_u8 string = push_buffer_range(app, scratch, buffer_id, og_edit_range);
+        String_Const_u8 yeet_string = push_buffer_range(app, scratch, yeet_buffer, yeet_edit_range);
+        if (string_match(string, yeet_string)) continue;
+        
+        Batch_Edit *edit = &edits[edits_count];
+        edit->edit.range = yeet_edit_range;
+        edit->edit.text = string;
+        order[edits_count] = edits_count;
+        order_keys[edits_count] = edit->edit.range.min;
+        edits_count += 1;
+    }
+    
+    if (edits_count > 0)
+    {
+        loco_sort_by_key_i64(scratch, order_keys, order, edits_count);
+        Batch_Edit *first = 0;
+        for (i32 e = edits_count - 1; e >= 0; e--)
+        {
+            Batch_Edit *edit = &edits[order[e]];
+            edit->next = first;
+            first = edit;
+        }
+        loco_sync_guard_push(app, yeet_buffer);
+        buffer_batch_edit(app, yeet_buffer, first);
+        loco_sync_guard_pop(app, yeet_buffer);
+    }
+    
+    if (any_stale)
+    {
+        loco_overwrite_yeets(app, yeet_buffer, &yeets);
+        loco_yeet_stale_pending = true;
+    }
+    if (any_lost) loco_anchor_mark_lost(app, buffer_id);
+    if (any_near) loco_anchor_mark_dirty(app, buffer_id, all_dirty);
+}
+
+//~ @buffer @edit @sync
+// Sends the dirty ranges of a source buffer to every sheet that holds pairs from it. The
+// source markers are loaded once however many sheets mirror it.
+static void
+loco_fan_out_source_edits(Application_Links *app, Buffer_ID buffer_id, Loco_Dirty_Ranges *dirty)
+{
+    Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer_id);
+    if (source_sheets->count == 0) return;
+    Scratch_Block scratch(app);
+    i32 sheets_count = source_sheets->count;
+    Buffer_ID *sheets = push_array(scratch, Buffer_ID, sheets_count);
+    block_copy(sheets, source_sheets->ids, sizeof(Buffer_ID)*sheets_count);
+    
+    i32 og_markers_count = 0;
+    Marker *og_markers = loco_get_buffer_markers(app, scratch, buffer_id, &og_markers_count);
+    for (i32 s = 0; s < sheets_count; s++)
+    {
+        Loco_Yeet_Sheet *sheet = loco_get_yeet_sheet(app, sheets[s]);
+        if (sheet->is_read_only)
+        {
+            // Noted for loco_flush_read_only_sheets, the dirty range tells it which blocks.
+            loco_buffer_set_add(&sheet->dirty_sources, buffer_id);
+            loco_anchor_mark_dirty(app, buffer_id, loco_dirty_ranges_union(dirty));
+            continue;
+        }
+        loco_flush_source_edits(app, buffer_id, sheets[s], og_markers, og_markers_count, dirty);
+    }
+}
+
+//~ @buffer @edit @sync
+// Writes the dirty ranges of a sheet back to the sources of the blocks they touch. The
+// source writes aren't guarded, so they are noted on the sources and the same flush sends
+// them on to every other block that mirrors the same text. A block whose text was replaced
+// as a whole is written whole, but a block whose text was deleted, or that one single edit
+// replaced along with other blocks (e.g. select all and type), isn't written back and is
+// marked diverged instead, so clearing a sheet by hand never clears its sources.
+static void
+loco_flush_yeet_buffer_edits(Application_Links *app, Buffer_ID buffer_id, Loco_Dirty_Ranges *dirty)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, buffer_id);
+    i32 yeet_markers_count = 0;
+    Marker* yeet_markers = loco_get_buffer_markers(app, scratch, buffer_id, &yeet_markers_count);
+    // How many blocks each dirty range that is one edit enclosed.
+    i32 enclosed_count[ArrayCount(dirty->ranges)] = {};
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair& pair = yeets.pairs[i];
+        if (pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        Range_i64 dirty_range = {};
+        i32 reach_count = 0;
+        i32 r = loco_dirty_ranges_at(dirty, yeet_range, &dirty_range, &reach_count);
+        if (r < 0 || reach_count != 1 || !dirty->is_one_edit[r]) continue;
+        if (loco_classify_block_edit(yeet_range, dirty_range) == Loco_Block_Edit_Enclosing) enclosed_count[r] += 1;
+    }
+    
+    bool any_flags_changed = false;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair& pair = yeets.pairs[i];
+        if (!buffer_exists(app, pair.buffer)) continue;
+        // Placeholders never go back to the source.
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Lazy)) continue;
+        if (pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        
+        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        Range_i64 dirty_range = {};
+        i32 reach_count = 0;
+        i32 first_dirty = loco_dirty_ranges_at(dirty, yeet_range, &dirty_range, &reach_count);
+        if (first_dirty < 0) continue;
+        Loco_Block_Edit_Kind kind = loco_classify_block_edit(yeet_range, dirty_range);
+        if (kind == Loco_Block_Edit_None) continue;
+        bool is_replaced = (reach_count == 1 && enclosed_count[first_dirty] > 1);
+        if (kind == Loco_Block_Edit_Enclosing && (is_replaced || range_size(yeet_range) == 0))
+        {
+            pair.flags |= Loco_Pair_Flag_Diverged;
+            any_flags_changed = true;
+            continue;
+        }
+        
+        Scratch_Block og_scratch(app);
+        i32 og_markers_count = 0;
+        Marker* og_markers = loco_get_buffer_markers(app, og_scratch, pair.buffer, &og_markers_count);
+        if (pair.end_marker_idx >= og_markers_count) continue;
+        Range_i64 og_range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        Range_i64 yeet_edit_range = yeet_range;
+        Range_i64 og_edit_range = og_range;
+        if (kind != Loco_Block_Edit_Enclosing)
+        {
+            loco_get_block_edit_ranges(dirty_range, yeet_range, og_range, &yeet_edit_range, &og_edit_range);
+        }
+        else if (HasFlag(pair.flags, Loco_Pair_Flag_Diverged))
+        {
+            // Typed in again after it was emptied, the block is written back whole.
+            pair.flags &= ~Loco_Pair_Flag_Diverged;
+            any_flags_changed = true;
+        }
+        String_Const_u8 string = push_buffer_range(app, og_scratch, buffer_id, yeet_edit_range);
+        String_Const_u8 og_string = push_buffer_range(app, og_scratch, pair.buffer, og_edit_range);
+        if (string_match(string, og_string)) continue;
+        buffer_replace_range(app, pair.buffer, og_edit_range, string);
+    }
+    
+    if (any_flags_changed) loco_overwrite_yeets(app, buffer_id, &yeets);
+}
+
+//~ @sync
+// Sends every edit noted since the last flush on. Sheets go first so the source edits they
+// make are sent on to the sources' other mirrors in the same flush. Called once per frame
+// from loco_tick, so a paste, a multi-cursor edit or a macro costs one sync per block.
+// Returns false if there was nothing to send.
+static bool
+loco_flush_pending_sync(Application_Links *app)
+{
+    Loco_Buffer_Set *pending = &loco_yeet_pending_buffers;
+    if (pending->count == 0) return false;
+    for (i32 pass = 0; pass < 2; pass++)
+    {
+        // Sources written by the first pass are appended while it runs.
+        for (i32 i = 0; i < pending->count; i++)
+        {
+            Buffer_ID buffer = pending->ids[i];
+            if (!buffer_exists(app, buffer)) continue;
+            bool is_sheet = loco_is_yeet_sheet(app, buffer);
+            if (is_sheet != (pass == 0)) continue;
+            Loco_Dirty_Ranges *sync = loco_get_pending_sync(app, buffer);
+            if (sync->count == 0) continue;
+            Loco_Dirty_Ranges dirty = *sync;
+            block_zero_struct(sync);
+            if (is_sheet)
+            {
+                loco_flush_yeet_buffer_edits(app, buffer, &dirty);
+            }
+            else
+            {
+                loco_fan_out_source_edits(app, buffer, &dirty);
+            }
+        }
+    }
+    pending->count = 0;
+    return true;
+}
+
+//~ @api @buffer @edit @sync
+// Only notes the edit, loco_flush_pending_sync sends it on. Edits the sync makes itself are
+// made with their buffer's guard held, they only move the pending range.
+api(LOCO) void 
+loco_on_buffer_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
+{
+    if (buffer_id == loco_yeet_streaming_buffer) return;
+    loco_nest_index_on_edit(app, buffer_id, old_range, new_range);
+    loco_line_table_on_edit(app, buffer_id, old_range, new_range);
+    bool is_synced = false;
+    bool is_sheet = loco_is_yeet_sheet(app, buffer_id);
+    if (is_sheet || loco_get_source_sheets(app, buffer_id)->count > 0)
+    {
+        // Every edit, the sync's own too, changes what loco_yeet_verify has to hash again.
+        loco_dirty_range_note(loco_get_verify_dirty(app, buffer_id), old_range, new_range, true);
+    }
+    if (is_sheet)
+    {
+        // Typing over a portal stand-in has no source text to go to, and a read-only
+        // sheet is only written by the sync.
+        Loco_Yeet_Sheet *sheet = loco_get_yeet_sheet(app, buffer_id);
+        is_synced = (!sheet->is_portal && !sheet->is_read_only);
+    }
+    else
+    {
+        is_synced = (loco_get_source_sheets(app, buffer_id)->count > 0);
+    }
+    if (!is_synced) return;
+    loco_pending_sync_note(app, buffer_id, old_range, new_range, *loco_get_sync_guard(app, buffer_id) == 0);
+}
+
+//~ @render
+static void
+loco_draw_yeet_range_highlight(Application_Links *app, Text_Layout_ID text_layout_id, i64 start_line_number, i64 end_line_number)
+{
+    draw_line_highlight(
+                        app, 
+                        text_layout_id, 
+                        start_line_number, 
+                        loco_yeet_highlight_start_color);
+    draw_line_highlight(
+                        app, 
+                        text_layout_id, 
+                        end_line_number, 
+                        loco_yeet_highlight_end_color);
+}
+
+//~ @render @portal
+// Dims the text of a portal view that is outside its block.
+static void
+loco_draw_portal_frame(Application_Links *app, View_ID view_id, Buffer_ID buffer, Text_Layout_ID text_layout_id)
+{
+    Managed_Scope view_scope = view_get_managed_scope(app, view_id);
+    Loco_Portal *portal = scope_attachment(app, view_scope, loco_view_portal_handle, Loco_Portal);
+    if (portal->buffer != buffer) return;
+    
+    Scratch_Block scratch(app);
+    i32 markers_count = 0;
+    Marker *markers = loco_get_buffer_markers(app, scratch, buffer, &markers_count);
+    if (portal->start_marker_idx >= markers_count || portal->end_marker_idx >= markers_count) return;
+    Range_i64 range = loco_make_range_from_markers(markers, portal->start_marker_idx, portal->end_marker_idx);
+    
+    Range_i64 visible_range = text_layout_get_visible_range(app, text_layout_id);
+    Rect_f32 region = text_layout_region(app, text_layout_id);
+    if (range.min > visible_range.min)
+    {
+        i64 start_line = get_line_number_from_pos(app, buffer, Min(range.min, visible_range.max));
+        Rect_f32 start_rect = text_layout_line_on_screen(app, text_layout_id, start_line);
+        if (range.min > visible_range.max) start_rect.y0 = region.y1;
+        draw_rectangle_fcolor(app, Rf32(region.x0, region.y0, region.x1, start_rect.y0), 0.f, loco_yeet_portal_dim_color);
+    }
+    if (range.max < visible_range.max)
+    {
+        i64 end_line = get_line_number_from_pos(app, buffer, Max(range.max, visible_range.min));
+        Rect_f32 end_rect = text_layout_line_on_screen(app, text_layout_id, end_line);
+        if (range.max < visible_range.min) end_rect.y1 = region.y0;
+        draw_rectangle_fcolor(app, Rf32(region.x0, end_rect.y1, region.x1, region.y1), 0.f, loco_yeet_portal_dim_color);
+    }
+}
+
+//~ @api @buffer @render
+api(LOCO) void
+loco_render_buffer(Application_Links *app, View_ID view_id, Face_ID face_id,
+                   Buffer_ID buffer, Text_Layout_ID text_layout_id,
+                   Rect_f32 rect, Frame_Info frame_info)
+{
+    Scratch_Block scratch(app);
+    if (!loco_is_yeet_sheet(app, buffer))
+    {
+        loco_draw_portal_frame(app, view_id, buffer, text_layout_id);
+        
+        // A source buffer highlights its blocks from every sheet that holds them.
+        if (!loco_yeet_show_highlight_ranges) return;
+        Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer);
+        i32 markers_count = 0;
+        Marker *markers = loco_get_buffer_markers(app, scratch, buffer, &markers_count);
+        i32 sheets_count = source_sheets->count;
+        Loco_Yeets *sheet_yeets = push_array(scratch, Loco_Yeets, sheets_count);
+        i32 pairs_count = 0;
+        for (i32 s = 0; s < sheets_count; s++)
+        {
+            sheet_yeets[s] = loco_get_buffer_yeets(app, scratch, source_sheets->ids[s]);
+            pairs_count += sheet_yeets[s].pairs_count;
+        }
+        i64 *positions = push_array(scratch, i64, pairs_count*2);
+        i32 positions_count = 0;
+        for (i32 s = 0; s < sheets_count; s++)
+        {
+            for (i32 i = 0; i < sheet_yeets[s].pairs_count; i++)
+            {
+                Loco_Marker_Pair pair = sheet_yeets[s].pairs[i];
+                if (pair.buffer != buffer || pair.end_marker_idx >= markers_count) continue;
+                Range_i64 range = loco_make_range_from_markers(markers, pair.start_marker_idx, pair.end_marker_idx);
+                positions[positions_count++] = range.min;
+                positions[positions_count++] = range.max;
+            }
+        }
+        i64 *lines = push_array(scratch, i64, positions_count);
+        loco_get_line_numbers(app, scratch, buffer, positions, lines, positions_count);
+        for (i32 i = 0; i < positions_count; i += 2)
+        {
+            loco_draw_yeet_range_highlight(app, text_layout_id, lines[i], lines[i + 1]);
+        }
+        return;
+    }
+    
+    Buffer_ID yeet_buffer = buffer;
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 markers_count = 0;
+    Marker* markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &markers_count);
+    
+    {
+        // Remember what this view shows so loco_tick can fill in visible placeholders,
+        // and make sure there is a next frame for it to do so. A portal sheet's
+        // placeholders are never filled in.
+        Range_i64 visible_range = text_layout_get_visible_range(app, text_layout_id);
+        Managed_Scope view_scope = view_get_managed_scope(app, view_id);
+        Range_i64 *stored_range = scope_attachment(app, view_scope, loco_view_visible_range_handle, Range_i64);
+        *stored_range = visible_range;
+        
+        bool is_portal = loco_get_yeet_sheet(app, yeet_buffer)->is_portal;
+        for (i32 i = 0; !is_portal && i < yeets.pairs_count; i++)
+        {
+            Loco_Marker_Pair pair = yeets.pairs[i];
+            if (!HasFlag(pair.flags, Loco_Pair_Flag_Lazy) || pair.yeet_end_marker_idx >= markers_count) continue;
+            Range_i64 yeet_range = loco_make_range_from_markers(markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+            if (yeet_range.min <= visible_range.max && visible_range.min <= yeet_range.max)
+            {
+                animate_in_n_milliseconds(app, 0);
+                break;
+            }
+        }
+    }
+    
+    if (loco_yeet_show_source_comment)
+    {
+        Range_i64 *og_ranges = push_array(scratch, Range_i64, yeets.pairs_count);
+        i64 *og_lines = push_array(scratch, i64, yeets.pairs_count*2);
+        loco_get_pair_source_lines(app, scratch, &yeets, og_ranges, og_lines);
+        f32 line_height = get_view_line_height(app, view_id);
+        FColor comment_color = loco_yeet_source_comment_color;
+        for (i32 i = 0; i < yeets.pairs_count; i++)
+        {
+            Loco_Marker_Pair pair = yeets.pairs[i];
+            if (pair.yeet_start_marker_idx >= markers_count) continue;
+            
+            Fancy_Line line = {};
+            if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant))
+            {
+                String_Const_u8 path = loco_path_from_id(pair.file_id);
+                push_fancy_string(scratch, &line, fcolor_zero(), string_front_of_path(path));
+                push_fancy_string(scratch, &line, fcolor_zero(), string_u8_litexpr(" - closed"));
+            }
+            else
+            {
+                if (!buffer_exists(app, pair.buffer)) continue;
+                Range_i64 og_range = og_ranges[i];
+                i64 start_line = og_lines[i*2];
+                i64 end_line = og_lines[i*2 + 1];
+                String_Const_u8 unique_name = push_buffer_unique_name(app, scratch, pair.buffer);
+                push_fancy_string(scratch, &line, fcolor_zero(), unique_name);
+                push_fancy_stringf(scratch, &line, fcolor_zero(), " - Lines: %3.lld - %3.lld", start_line, end_line);
+                if (HasFlag(pair.flags, Loco_Pair_Flag_Diverged))
+                {
+                    push_fancy_string(scratch, &line, fcolor_zero(), string_u8_litexpr(" - diverged"));
+                }
+                Loco_Sync_Job *job = loco_find_sync_job(yeet_buffer, pair.uid);
+                if (HasFlag(pair.flags, Loco_Pair_Flag_Syncing) && job != 0)
+                {
+                    i64 percent = (range_size(og_range) > 0) ? (100*job->done)/range_size(og_range) : 100;
+                    push_fancy_stringf(scratch, &line, fcolor_zero(), " - syncing %lld%%", percent);
+                }
+            }
+            i64 start_pos = markers[pair.yeet_start_marker_idx].pos;
+            Rect_f32 start_rect = text_layout_character_on_screen(app, text_layout_id, start_pos);
+            Vec2_f32 comment_pos = { start_rect.x0 + 0, start_rect.y0 - line_height };
+            draw_fancy_line(app, face_id, comment_color, &line, comment_pos);
+        }
+    }
+    
+    if (loco_yeet_show_highlight_ranges)
+    {
+        i64 *positions = push_array(scratch, i64, yeets.pairs_count*2);
+        i64 *lines = push_array(scratch, i64, yeets.pairs_count*2);
+        i32 positions_count = 0;
+        for (i32 i = 0; i < yeets.pairs_count; i++)
+        {
+            Loco_Marker_Pair pair = yeets.pairs[i];
+            if (pair.yeet_end_marker_idx >= markers_count) continue;
+            Range_i64 range = loco_make_range_from_markers(markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+            positions[positions_count++] = range.min;
+            positions[positions_count++] = range.max;
+        }
+        loco_get_line_numbers(app, scratch, buffer, positions, lines, positions_count);
+        for (i32 i = 0; i < positions_count; i += 2)
+        {
+            loco_draw_yeet_range_highlight(app, text_layout_id, lines[i], lines[i + 1]);
+        }
+    }
+}
+
+//~ @api @buffer
+api(LOCO) void
+loco_on_buffer_begin(Application_Links *app, Buffer_ID buffer_id)
+{
+    loco_bind_dormant_pairs(app, buffer_id);
+}
+
+//~ @api @buffer
+api(LOCO) void
+loco_on_buffer_end(Application_Links *app, Buffer_ID buffer_id)
+{
+    loco_buffer_set_remove(&loco_yeet_pending_buffers, buffer_id);
+    loco_line_table_free(app, buffer_id);
+    if (loco_is_yeet_sheet(app, buffer_id))
+    {
+        // The live table and history aren't in the buffer's managed memory, drop our references.
+        Loco_Pair_Table **live_table = loco_get_yeet_pair_table(app, buffer_id);
+        loco_reindex_sheet_sources(app, buffer_id, *live_table, 0);
+        loco_pair_table_release(*live_table);
+        *live_table = 0;
+        Loco_Yeet_History *history = &loco_get_yeet_sheet(app, buffer_id)->history;
+        loco_yeet_history_clear(history);
+        Base_Allocator *allocator = get_base_allocator_system();
+        if (history->undo != 0) base_free(allocator, history->undo);
+        if (history->redo != 0) base_free(allocator, history->redo);
+        block_zero_struct(history);
+        loco_buffer_set_free(&loco_get_yeet_sheet(app, buffer_id)->dirty_sources);
+        loco_buffer_set_remove(&loco_yeet_sheets.buffers, buffer_id);
+        if (loco_yeet_sheets.current == buffer_id) loco_yeet_sheets.current = 0;
+        return;
+    }
+    
+    // Pairs from a file go dormant in place, their yeet blocks stay in the sheet.
+    if (loco_make_pairs_dormant(app, buffer_id) && yeets_snapshots.count > 0)
+    {
+        loco_yeet_snapshot_file_dirty = true;
+    }
+    
+    // What is left belongs to a buffer without a file, it can't come back.
+    Scratch_Block scratch(app);
+    Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer_id);
+    i32 sheets_count = source_sheets->count;
+    Buffer_ID *sheets = push_array(scratch, Buffer_ID, sheets_count);
+    block_copy(sheets, source_sheets->ids, sizeof(Buffer_ID)*sheets_count);
+    for (i32 s = 0; s < sheets_count; s++)
+    {
+        Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, sheets[s]);
+        for (i32 i = yeets.pairs_count - 1; i >= 0; i--)
+        {
+            if (yeets.pairs[i].buffer == buffer_id)
+            {
+                loco_delete_marker_pair(app, sheets[s], &yeets, i);
+            }
+        }
+    }
+    // Snapshots and undo versions drop them too, nothing could ever bind them again.
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        snapshot->table = loco_pair_table_remove_buffer(scratch, snapshot->table, buffer_id);
+    }
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
+    {
+        Loco_Yeet_History *history = &loco_get_yeet_sheet(app, loco_yeet_sheets.buffers.ids[s])->history;
+        for (i32 v = 0; v < history->undo_count; v++)
+        {
+            history->undo[v] = loco_pair_table_remove_buffer(scratch, history->undo[v], buffer_id);
+        }
+        for (i32 v = 0; v < history->redo_count; v++)
+        {
+            history->redo[v] = loco_pair_table_remove_buffer(scratch, history->redo[v], buffer_id);
+        }
+    }
+    
+    loco_buffer_set_free(loco_get_source_sheets(app, buffer_id));
+    loco_nest_index_free(app, buffer_id);
+}
+
+//~
+// Finds the block of one sheet that cursor_pos is in, buffer being the sheet itself or one
+// of its sources.
+static bool
+loco_find_yeet_at(Application_Links *app, Buffer_ID yeet_buffer, Buffer_ID buffer, i64 cursor_pos, i64 *out_dst_cursor_pos, Buffer_ID *out_dst_buffer,
+                  Loco_Marker_Pair *out_pair)
+{
+    bool is_yeet_buffer = (buffer == yeet_buffer);
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair pair = yeets.pairs[i];
+        if (!is_yeet_buffer && pair.buffer != buffer) continue;
+        Buffer_ID src_buf = is_yeet_buffer ? yeet_buffer : pair.buffer;
+        i32 src_start = is_yeet_buffer ? pair.yeet_start_marker_idx : pair.start_marker_idx;
+        i32 src_end = is_yeet_buffer ? pair.yeet_end_marker_idx : pair.end_marker_idx;
+        Range_i64 src_range = loco_get_marker_range(app, src_buf, src_start, src_end);
+        bool is_cursor_inside = (cursor_pos >= src_range.min && cursor_pos <= src_range.max);
+        if (is_cursor_inside)
+        {
+            // A dormant block has nowhere to jump to, dst_buffer is 0.
+            Buffer_ID dst_buf = !is_yeet_buffer ? yeet_buffer : pair.buffer;
+            i32 dst_start = !is_yeet_buffer ? pair.yeet_start_marker_idx : pair.start_marker_idx;
+            i32 dst_end = !is_yeet_buffer ? pair.yeet_end_marker_idx : pair.end_marker_idx;
+            Range_i64 dst_range = {};
+            if (buffer_exists(app, dst_buf)) dst_range = loco_get_marker_range(app, dst_buf, dst_start, dst_end);
+            if (out_dst_cursor_pos != 0)
+            {
+                // A portal stand-in is shorter than its source, stay inside the block.
+                *out_dst_cursor_pos = clamp_top(dst_range.min + (cursor_pos - src_range.min), dst_range.max);
+            }
+            if (out_dst_buffer != 0)
+            {
+                *out_dst_buffer = dst_buf;
+            }
+            if (out_pair != 0)
+            {
+                *out_pair = pair;
+            }
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+//~
+// Looks in the sheet for the active view's buffer, or if it's a source buffer in the
+// current sheet and then the other sheets that hold it.
+static bool
+loco_is_cursor_inside_yeet(Application_Links *app, i64 cursor_pos, i64 *out_dst_cursor_pos, Buffer_ID *out_dst_buffer)
+{
+    View_ID view = get_active_view(app, Access_Always);
+    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
+    if (loco_is_yeet_sheet(app, buffer))
+    {
+        return loco_find_yeet_at(app, buffer, buffer, cursor_pos, out_dst_cursor_pos, out_dst_buffer, 0);
+    }
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    if (loco_find_yeet_at(app, yeet_buffer, buffer, cursor_pos, out_dst_cursor_pos, out_dst_buffer, 0))
+    {
+        return true;
+    }
+    Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer);
+    for (i32 s = 0; s < source_sheets->count; s++)
+    {
+        if (source_sheets->ids[s] == yeet_buffer) continue;
+        if (loco_find_yeet_at(app, source_sheets->ids[s], buffer, cursor_pos, out_dst_cursor_pos, out_dst_buffer, 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//~ @jump @buffer
+static void
+loco_jump_to_buffer(Application_Links *app, Buffer_ID dst_buffer, i64 dst_cursor)
+{
+    View_ID view = get_next_view_after_active(app, Access_Always);
+    view_set_buffer(app, view, dst_buffer, 0);
+    view_set_active(app, view);
+    loco_set_current_yeet_sheet(app, dst_buffer);
+    view_set_cursor_and_preferred_x(app, view, seek_pos(dst_cursor));
+    if (auto_center_after_jumps)
+    {
+        center_view(app);
+    }
+}
+
+//~ @jump
+static bool
+loco_try_jump_between_yeet_pair(Application_Links *app)
+{
+    View_ID view = get_active_view(app, Access_Always);
+    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
+    i64 cursor_pos = view_get_cursor_pos(app, view);
+    i64 dst_cursor_pos = 0;
+    Buffer_ID dst_buffer = 0;
+    bool success = loco_is_cursor_inside_yeet(app, cursor_pos, &dst_cursor_pos, &dst_buffer);
+    if (success && buffer_exists(app, dst_buffer))
+    {
+        loco_jump_to_buffer(app, dst_buffer, dst_cursor_pos);
+        
+        // Jumping out of a portal sheet frames the block in the view it lands in.
+        Loco_Marker_Pair pair = {};
+        if (loco_is_yeet_sheet(app, buffer) && loco_get_yeet_sheet(app, buffer)->is_portal &&
+            loco_find_yeet_at(app, buffer, buffer, cursor_pos, 0, 0, &pair))
+        {
+            View_ID portal_view = get_active_view(app, Access_Always);
+            Managed_Scope view_scope = view_get_managed_scope(app, portal_view);
+            Loco_Portal *portal = scope_attachment(app, view_scope, loco_view_portal_handle, Loco_Portal);
+            portal->buffer = pair.buffer;
+            portal->start_marker_idx = pair.start_marker_idx;
+            portal->end_marker_idx = pair.end_marker_idx;
+        }
+    }
+    return success;
+}
+
+//~ @buffer
+// Appends a block of text to a buffer as "\n" + text + "\n\n".
+// Returns the insertion region of the text in the dest buffer.
+static Range_i64
+loco_append_block_to_buffer(Application_Links *app, 
+                            Arena * arena, 
+                            Buffer_ID dst_buffer, 
+                            String_Const_u8 copy_string)
+{
+    // Find dest buffer pos to start insertion.
+    i64 dst_insert_start = (i64)buffer_get_size(app, dst_buffer);
+    
+    // Insert range to yeet buffer.
+    loco_sync_guard_push(app, dst_buffer);
+    Buffer_Insertion insert = begin_buffer_insertion_at_buffered(app, dst_buffer, dst_insert_start, arena, KB(16));
+    insertc(&insert, '\n');
+    insert_string(&insert, copy_string);
+    insertc(&insert, '\n');
+    insertc(&insert, '\n');
+    end_buffer_insertion(&insert);
+    loco_sync_guard_pop(app, dst_buffer);
+    
+    // Find dest end buffer pos.
+    i64 dst_insert_end = (i64)buffer_get_size(app, dst_buffer);
+    
+    // +1 to ignore start newline.
+    // -2 to ignore the two end newlines.
+    return Ii64(dst_insert_start + 1, dst_insert_end - 2);
+}
+
+//~ @buffer
+// Copies text region from one buffer to another buffer (appends to end)
+// A range bigger than loco_yeet_sync_chunk_size is streamed through one chunk of the arena,
+// so yeeting a huge range doesn't need a copy of all of it. The chunks are one undo step,
+// and the edit hook sees them as one edit. If the source can't be read the block gets the
+// lazy placeholder and out_is_complete is set to false.
+// Returns the insertion region in the dest buffer.
+static Range_i64
+loco_copy_buffer_text_to_buffer(Application_Links *app, 
+                                Arena * arena, 
+                                Buffer_ID src_buffer, 
+                                Buffer_ID dst_buffer, 
+                                Range_i64 src_range,
+                                bool *out_is_complete)
+{
+    *out_is_complete = true;
+    if (range_size(src_range) <= loco_yeet_sync_chunk_size)
+    {
+        // Copy range string from original buffer.
+        String_Const_u8 copy_string = SCu8(push_array(arena, u8, range_size(src_range)), range_size(src_range));
+        if (!buffer_read_range(app, src_buffer, src_range, copy_string.str))
+        {
+            copy_string = SCu8(loco_yeet_lazy_placeholder);
+            *out_is_complete = false;
+        }
+        return loco_append_block_to_buffer(app, arena, dst_buffer, copy_string);
+    }
+    
+    Temp_Memory temp = begin_temp(arena);
+    i64 chunk_size = loco_yeet_sync_chunk_size;
+    u8 *chunk = push_array(arena, u8, chunk_size);
+    i64 dst_insert_start = (i64)buffer_get_size(app, dst_buffer);
+    i64 dst_pos = dst_insert_start + 1;
+    
+    History_Group group = history_group_begin(app, dst_buffer);
+    loco_sync_guard_push(app, dst_buffer);
+    loco_yeet_streaming_buffer = dst_buffer;
+    buffer_replace_range(app, dst_buffer, Ii64(dst_insert_start), string_u8_litexpr("\n"));
+    for (i64 pos = src_range.min; pos < src_range.max; pos += chunk_size)
+    {
+        i64 size = Min(chunk_size, src_range.max - pos);
+        if (!buffer_read_range(app, src_buffer, Ii64(pos, pos + size), chunk))
+        {
+            // Drop the part that was copied, the placeholder is filled in again later.
+            String_Const_u8 placeholder = SCu8(loco_yeet_lazy_placeholder);
+            buffer_replace_range(app, dst_buffer, Ii64(dst_insert_start + 1, dst_pos), placeholder);
+            dst_pos = dst_insert_start + 1 + (i64)placeholder.size;
+            *out_is_complete = false;
+            break;
+        }
+        buffer_replace_range(app, dst_buffer, Ii64(dst_pos), SCu8(chunk, size));
+        dst_pos += size;
+    }
+    buffer_replace_range(app, dst_buffer, Ii64(dst_pos), string_u8_litexpr("\n\n"));
+    loco_yeet_streaming_buffer = 0;
+    loco_on_buffer_edit(app, dst_buffer, Ii64(dst_insert_start), Ii64(dst_insert_start, dst_pos + 2));
+    loco_sync_guard_pop(app, dst_buffer);
+    history_group_end(group);
+    end_temp(temp);
+    
+    return Ii64(dst_insert_start + 1, dst_pos);
+}
+
+//~ @marker @append
+// Append two markers that sit and the start and end of a range.
+static i32
+loco_append_marker_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
+{
+    Marker markers[2];
+    markers[0].pos = range.min; 
+    markers[0].lean_right = false;
+    markers[1].pos = range.max;
+    markers[1].lean_right = true;
+    return loco_append_markers(app, buffer, markers, 2);
+}
+
+//~ @snapshot
+// Saving only takes a reference to the live pair table, so it costs the same for any
+// number of pairs. The table is copied on the next change to the sheet and even then
+// the chunks that didn't change stay shared.
+static void
+loco_save_yeet_snapshot(Application_Links *app, String_Const_u8 name)
+{
+    loco_ensure_yeet_snapshots_file_loaded(app);
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Loco_Pair_Table **live_table = loco_get_yeet_pair_table(app, yeet_buffer);
+    Loco_Yeet_Snapshot *snapshot = loco_get_or_make_yeet_snapshot(name);
+    Loco_Pair_Table *old_table = snapshot->table;
+    snapshot->table = loco_pair_table_retain(*live_table);
+    loco_pair_table_release(old_table);
+    loco_set_active_yeet_snapshot(snapshot->name);
+    loco_yeet_snapshot_file_dirty = true;
+}
+
+//~ @snapshot
+// Pairs of a snapshot in sheet order, leaving out dormant pairs. They stay in the
+// snapshot until their file is opened.
+static Loco_Yeets
+loco_get_snapshot_sheet_pairs(Application_Links *app, Arena *arena, Loco_Yeet_Snapshot *snapshot)
+{
+    // Tables are stored in sheet order, see loco_overwrite_yeets.
+    Loco_Yeets all_yeets = loco_pair_table_flatten(arena, snapshot->table);
+    Loco_Yeets yeets = {};
+    yeets.pairs = push_array(arena, Loco_Marker_Pair, all_yeets.pairs_count);
+    for (i32 i = 0; i < all_yeets.pairs_count; i += 1)
+    {
+        Loco_Marker_Pair pair = all_yeets.pairs[i];
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant) || !buffer_exists(app, pair.buffer)) continue;
+        yeets.pairs[yeets.pairs_count++] = pair;
+    }
+    return yeets;
+}
+
+//~ @snapshot @marker
+// Loads a pair's source range, reusing the marker array while consecutive pairs come
+// from the same buffer.
+static Range_i64
+loco_get_pair_source_range(Application_Links *app, Arena *arena, Loco_Marker_Pair pair,
+                           Buffer_ID *cached_buffer, Marker **cached_markers, i32 *cached_markers_count)
+{
+    if (pair.buffer != *cached_buffer)
+    {
+        *cached_buffer = pair.buffer;
+        *cached_markers = loco_get_buffer_markers(app, arena, pair.buffer, cached_markers_count);
+    }
+    if (pair.end_marker_idx >= *cached_markers_count) return Ii64(0, 0);
+    return loco_make_range_from_markers(*cached_markers, pair.start_marker_idx, pair.end_marker_idx);
+}
+
+//~ @snapshot @diff
+// Marks the longest run of values that increase from left to right, in O(n log n).
+// Negative values are never part of the run.
+static b8*
+loco_mark_longest_increasing_run(Arena *arena, i32 *values, i32 count, i32 *out_run_count)
+{
+    i32 *tails = push_array(arena, i32, count);
+    i32 *parents = push_array(arena, i32, count);
+    i32 tails_count = 0;
+    for (i32 i = 0; i < count; i++)
+    {
+        if (values[i] < 0) continue;
+        i32 lo = 0;
+        i32 hi = tails_count;
+        while (lo < hi)
+        {
+            i32 mid = (lo + hi)/2;
+            if (values[tails[mid]] < values[i]) lo = mid + 1;
+            else hi = mid;
+        }
+        parents[i] = (lo > 0) ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == tails_count) tails_count += 1;
+    }
+    b8 *in_run = push_array_zero(arena, b8, count);
+    for (i32 i = (tails_count > 0) ? tails[tails_count - 1] : -1; i >= 0; i = parents[i])
+    {
+        in_run[i] = true;
+    }
+    *out_run_count = tails_count;
+    return in_run;
+}
+
+//~ @snapshot
+// Switches the sheet to a snapshot by diffing it against the live pairs, matched by uid.
+// The longest run of live blocks that are already in the snapshot's order stays in place
+// with its text and markers, the other live blocks are removed and the missing ones are
+// inserted next to the kept block they come before. Switching between two similar
+// snapshots only touches the blocks that differ, and any switch, including loading into
+// an empty sheet, is a single batch edit with the yeet markers allocated once.
+static void
+loco_load_yeet_snapshot(Application_Links *app, Loco_Yeet_Snapshot *snapshot)
+{
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Scratch_Block scratch(app);
+    Loco_Yeets target = loco_get_snapshot_sheet_pairs(app, scratch, snapshot);
+    
+    // Live blocks in sheet order.
+    Loco_Yeets live = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 yeet_markers_count = 0;
+    Marker *yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    i32 *live_sorter = push_array(scratch, i32, live.pairs_count);
+    i64 *live_keys = push_array(scratch, i64, live.pairs_count);
+    i32 live_count = 0;
+    for (i32 i = 0; i < live.pairs_count; i++)
+    {
+        Loco_Marker_Pair pair = live.pairs[i];
+        if (pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        live_sorter[live_count] = i;
+        live_keys[live_count] = yeet_markers[pair.yeet_start_marker_idx].pos;
+        live_count += 1;
+    }
+    loco_sort_by_key_i64(scratch, live_keys, live_sorter, live_count);
+    Range_i64 *live_ranges = push_array(scratch, Range_i64, live_count);
+    for (i32 i = 0; i < live_count; i++)
+    {
+        Loco_Marker_Pair pair = live.pairs[live_sorter[i]];
+        live_ranges[i] = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+    }
+    
+    // Where each live block sits in the target, or -1.
+    Table_u64_u64 target_from_uid = make_table_u64_u64(get_base_allocator_system(), target.pairs_count*2 + 8);
+    for (i32 j = 0; j < target.pairs_count; j++)
+    {
+        table_insert(&target_from_uid, target.pairs[j].uid, (u64)j);
+    }
+    i32 *live_target = push_array(scratch, i32, live_count);
+    for (i32 i = 0; i < live_count; i++)
+    {
+        u64 j = 0;
+        live_target[i] = table_read(&target_from_uid, live.pairs[live_sorter[i]].uid, &j) ? (i32)j : -1;
+    }
+    table_free(&target_from_uid);
+    
+    // Keep the longest increasing run of target indices.
+    i32 kept_count = 0;
+    b8 *kept = loco_mark_longest_increasing_run(scratch, live_target, live_count, &kept_count);
+    
+    // Source ranges of the target blocks, and room for the text of every block that
+    // might be inserted so the whole sheet is built in one arena pass.
+    // A lazy load only inserts placeholders, so the sources aren't touched at all.
+    // A portal sheet always loads that way, with its own stand-in.
+    bool is_portal = loco_get_yeet_sheet(app, yeet_buffer)->is_portal;
+    bool is_lazy = loco_yeet_lazy_snapshot_load || is_portal;
+    String_Const_u8 placeholder = SCu8(is_portal ? loco_yeet_portal_placeholder : loco_yeet_lazy_placeholder);
+    Range_i64 *src_ranges = push_array(scratch, Range_i64, target.pairs_count);
+    i64 max_text_size = 0;
+    if (is_lazy)
+    {
+        max_text_size = (i64)(placeholder.size + 3)*target.pairs_count;
+    }
+    else
+    {
+        Buffer_ID cached_buffer = 0;
+        Marker *cached_markers = 0;
+        i32 cached_markers_count = 0;
+        for (i32 j = 0; j < target.pairs_count; j++)
+        {
+            src_ranges[j] = loco_get_pair_source_range(app, scratch, target.pairs[j], &cached_buffer, &cached_markers, &cached_markers_count);
+            // Room for the placeholder in case the source can't be read.
+            max_text_size += Max(range_size(src_ranges[j]), (i64)placeholder.size) + 3;
+        }
+    }
+    u8 *text = push_array(scratch, u8, max_text_size);
+    i64 at = 0;
+    
+    // Walk the sheet once, emitting the edits in position order. Every block is laid out
+    // as "\n" + text + "\n\n", like loco_copy_buffer_text_to_buffer.
+    Batch_Edit *edits = push_array(scratch, Batch_Edit, live_count + kept_count + 1);
+    i32 edits_count = 0;
+    Marker *new_yeet_markers = push_array(scratch, Marker, target.pairs_count*2);
+    i64 shift = 0;
+    i64 yeet_buffer_size = buffer_get_size(app, yeet_buffer);
+    i32 next_target = 0;
+    for (i32 i = 0; i <= live_count; i++)
+    {
+        bool is_end = (i == live_count);
+        if (!is_end && !kept[i])
+        {
+            // Take the block with its separators, without reaching into its neighbours.
+            i64 prev_max = (i > 0) ? live_ranges[i - 1].max : 0;
+            i64 next_min = (i + 1 < live_count) ? live_ranges[i + 1].min - 1 : yeet_buffer_size;
+            Range_i64 range = live_ranges[i];
+            range.min = clamp_bot(range.min - 1, prev_max);
+            range.max = clamp_top(range.max + 2, clamp_bot(next_min, range.max));
+            Edit &edit = edits[edits_count++].edit;
+            edit.text = SCu8("");
+            edit.range = range;
+            shift -= range_size(range);
+            continue;
+        }
+        
+        // Insert the target blocks that come before this kept block, or the rest at the end.
+        i32 target_end = is_end ? target.pairs_count : live_target[i];
+        if (next_target < target_end)
+        {
+            i64 insert_pos = yeet_buffer_size;
+            if (!is_end)
+            {
+                i64 prev_max = (i > 0) ? live_ranges[i - 1].max : 0;
+                insert_pos = clamp_bot(live_ranges[i].min - 1, prev_max);
+            }
+            
+            i64 text_start = at;
+            for (i32 j = next_target; j < target_end; j++)
+            {
+                Loco_Marker_Pair &pair = target.pairs[j];
+                i64 block_pos = insert_pos + shift + (at - text_start);
+                i64 block_size = 0;
+                text[at++] = '\n';
+                if (is_lazy)
+                {
+                    block_copy(text + at, placeholder.str, placeholder.size);
+                    block_size = (i64)placeholder.size;
+                    pair.flags = (pair.flags & ~Loco_Pair_Flag_Stale) | Loco_Pair_Flag_Lazy;
+                }
+                else if (buffer_read_range(app, pair.buffer, src_ranges[j], text + at))
+                {
+                    block_size = range_size(src_ranges[j]);
+                    pair.flags &= ~(Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale);
+                }
+                else
+                {
+                    // A placeholder the idle drain tries to fill in again.
+                    block_copy(text + at, placeholder.str, placeholder.size);
+                    block_size = (i64)placeholder.size;
+                    pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+                    loco_yeet_stale_pending = true;
+                }
+                at += block_size;
+                text[at++] = '\n';
+                text[at++] = '\n';
+                new_yeet_markers[j*2 + 0].pos = block_pos + 1;
+                new_yeet_markers[j*2 + 0].lean_right = false;
+                new_yeet_markers[j*2 + 1].pos = block_pos + 1 + block_size;
+                new_yeet_markers[j*2 + 1].lean_right = true;
+            }
+            
+            Edit &edit = edits[edits_count++].edit;
+            edit.text = SCu8(text + text_start, at - text_start);
+            edit.range = Ii64(insert_pos);
+            shift += at - text_start;
+        }
+        if (is_end) break;
+        
+        // The kept block only moves by what was edited before it, and keeps its text
+        // whether that is a placeholder or not.
+        i32 j = live_target[i];
+        Loco_Marker_Pair live_pair = live.pairs[live_sorter[i]];
+        u32 text_flags = Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+        target.pairs[j].flags = (target.pairs[j].flags & ~text_flags) | (live_pair.flags & text_flags);
+        target.pairs[j].fingerprint = live_pair.fingerprint;
+        new_yeet_markers[j*2 + 0].pos = live_ranges[i].min + shift;
+        new_yeet_markers[j*2 + 0].lean_right = false;
+        new_yeet_markers[j*2 + 1].pos = live_ranges[i].max + shift;
+        new_yeet_markers[j*2 + 1].lean_right = true;
+        next_target = j + 1;
+    }
+    
+    // One batch edit for the whole switch, its ranges are in the original coordinates.
+    if (edits_count > 0)
+    {
+        for (i32 e = 0; e < edits_count; e++)
+        {
+            edits[e].next = (e + 1 < edits_count) ? &edits[e + 1] : 0;
+        }
+        loco_sync_guard_push(app, yeet_buffer);
+        buffer_batch_edit(app, yeet_buffer, edits);
+        loco_sync_guard_pop(app, yeet_buffer);
+    }
+    
+    // The yeet markers are rebuilt in sheet order, the source markers are shared as they are.
+    for (i32 j = 0; j < target.pairs_count; j++)
+    {
+        target.pairs[j].yeet_start_marker_idx = j*2;
+        target.pairs[j].yeet_end_marker_idx = j*2 + 1;
+    }
+    loco_overwrite_buffer_markers(app, scratch, yeet_buffer, new_yeet_markers, target.pairs_count*2);
+    loco_overwrite_yeets(app, yeet_buffer, &target);
+    loco_set_active_yeet_snapshot(snapshot->name);
+    
+    // Show the yeet buffer in opposite view if not in yeet view already.
+    View_ID view = get_active_view(app, Access_Always);
+    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
+    if (buffer != yeet_buffer)
+    {
+        View_ID yeet_view = get_next_view_after_active(app, Access_Always);
+        view_set_buffer(app, yeet_view, yeet_buffer, 0);
+        view_set_cursor_and_preferred_x(app, yeet_view, seek_pos(0));
+    }
+}
+
+//~ @lazy @anchor
+// Replaces the yeet blocks of the given pairs with their current source text in one
+// batch edit, then stores the yeet markers with one overwrite. Used to fill in lazy
+// placeholders and to update blocks after their source was re-anchored.
+static void
+loco_refresh_yeet_blocks(Application_Links *app, Buffer_ID yeet_buffer, Loco_Yeets *yeets, i32 *pair_indices, i32 pair_indices_count)
+{
+    if (pair_indices_count == 0) return;
+    if (loco_get_yeet_sheet(app, yeet_buffer)->is_portal)
+    {
+        // A portal sheet keeps its stand-ins, only the pairs are stored.
+        loco_overwrite_yeets(app, yeet_buffer, yeets);
+        return;
+    }
+    Scratch_Block scratch(app);
+    i32 yeet_markers_count = 0;
+    Marker *yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    String_Const_u8 placeholder = SCu8(loco_yeet_lazy_placeholder);
+    
+    i32 *chosen = push_array(scratch, i32, pair_indices_count);
+    i64 *chosen_keys = push_array(scratch, i64, pair_indices_count);
+    i32 chosen_count = 0;
+    for (i32 c = 0; c < pair_indices_count; c++)
+    {
+        Loco_Marker_Pair pair = yeets->pairs[pair_indices[c]];
+        if (pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        // Its job fills it in.
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Syncing)) continue;
+        chosen[chosen_count] = pair_indices[c];
+        chosen_keys[chosen_count] = yeet_markers[pair.yeet_start_marker_idx].pos;
+        chosen_count += 1;
+    }
+    if (chosen_count == 0)
+    {
+        // The caller may have changed flags.
+        loco_overwrite_yeets(app, yeet_buffer, yeets);
+        return;
+    }
+    loco_sort_by_key_i64(scratch, chosen_keys, chosen, chosen_count);
+    
+    // Build the text for every chosen block in one pass. Blocks too big for one frame are
+    // handed to a sync job instead.
+    Range_i64 *src_ranges = push_array(scratch, Range_i64, chosen_count);
+    i64 text_size = 0;
+    Buffer_ID cached_buffer = 0;
+    Marker *cached_markers = 0;
+    i32 cached_markers_count = 0;
+    i32 kept_count = 0;
+    for (i32 c = 0; c < chosen_count; c++)
+    {
+        Loco_Marker_Pair &pair = yeets->pairs[chosen[c]];
+        Range_i64 src_range = loco_get_pair_source_range(app, scratch, pair, &cached_buffer, &cached_markers, &cached_markers_count);
+        if (range_size(src_range) > loco_yeet_sync_chunk_size)
+        {
+            pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Syncing;
+            loco_add_sync_job(yeet_buffer, pair.uid, 0);
+            continue;
+        }
+        chosen[kept_count] = chosen[c];
+        src_ranges[kept_count] = src_range;
+        // Room for the placeholder in case the source can't be read.
+        text_size += Max(range_size(src_range), (i64)placeholder.size);
+        kept_count += 1;
+    }
+    if (kept_count == 0)
+    {
+        loco_overwrite_yeets(app, yeet_buffer, yeets);
+        return;
+    }
+    chosen_count = kept_count;
+    u8 *text = push_array(scratch, u8, text_size);
+    Batch_Edit *edits = push_array(scratch, Batch_Edit, chosen_count);
+    i64 *shift_before = push_array(scratch, i64, chosen_count + 1);
+    shift_before[0] = 0;
+    i64 at = 0;
+    for (i32 c = 0; c < chosen_count; c++)
+    {
+        Loco_Marker_Pair &pair = yeets->pairs[chosen[c]];
+        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        i64 size = range_size(src_ranges[c]);
+        if (buffer_read_range(app, pair.buffer, src_ranges[c], text + at))
+        {
+            pair.flags &= ~(Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale);
+        }
+        else
+        {
+            // A placeholder the idle drain tries to fill in again.
+            size = (i64)placeholder.size;
+            block_copy(text + at, placeholder.str, size);
+            pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+            loco_yeet_stale_pending = true;
+        }
+        edits[c].next = (c + 1 < chosen_count) ? &edits[c + 1] : 0;
+        edits[c].edit.text = SCu8(text + at, size);
+        edits[c].edit.range = yeet_range;
+        shift_before[c + 1] = shift_before[c] + size - range_size(yeet_range);
+        at += size;
+    }
+    
+    // Work out where every yeet marker ends up, then store them with one overwrite.
+    Marker *new_yeet_markers = push_array(scratch, Marker, yeet_markers_count);
+    block_copy(new_yeet_markers, yeet_markers, sizeof(Marker)*yeet_markers_count);
+    for (i32 m = 0; m < yeet_markers_count; m++)
+    {
+        // Number of edits that end at or before the marker.
+        i64 pos = yeet_markers[m].pos;
+        i32 lo = 0;
+        i32 hi = chosen_count;
+        while (lo < hi)
+        {
+            i32 mid = (lo + hi)/2;
+            if (edits[mid].edit.range.max <= pos) lo = mid + 1;
+            else hi = mid;
+        }
+        new_yeet_markers[m].pos = pos + shift_before[lo];
+    }
+    for (i32 c = 0; c < chosen_count; c++)
+    {
+        Loco_Marker_Pair pair = yeets->pairs[chosen[c]];
+        i64 start = edits[c].edit.range.min + shift_before[c];
+        new_yeet_markers[pair.yeet_start_marker_idx].pos = start;
+        new_yeet_markers[pair.yeet_end_marker_idx].pos = start + (i64)edits[c].edit.text.size;
+    }
+    
+    loco_sync_guard_push(app, yeet_buffer);
+    buffer_batch_edit(app, yeet_buffer, edits);
+    loco_sync_guard_pop(app, yeet_buffer);
+    loco_overwrite_buffer_markers(app, scratch, yeet_buffer, new_yeet_markers, yeet_markers_count);
+    loco_overwrite_yeets(app, yeet_buffer, yeets);
+}
+
+//~ @lazy
+// Fills in the lazy pairs that touch any of the given yeet buffer ranges.
+// Returns the number of pairs filled in.
+static i32
+loco_materialize_lazy_pairs(Application_Links *app, Buffer_ID yeet_buffer, Range_i64 *ranges, i32 ranges_count)
+{
     Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
     i32 yeet_markers_count = 0;
-    Marker* yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    Marker *yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+    
+    i32 *chosen = push_array(scratch, i32, yeets.pairs_count);
+    i32 chosen_count = 0;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair pair = yeets.pairs[i];
+        if (!HasFlag(pair.flags, Loco_Pair_Flag_Lazy) || pair.yeet_end_marker_idx >= yeet_markers_count) continue;
+        // A closed file's placeholder waits for the file.
+        if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant)) continue;
+        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        for (i32 r = 0; r < ranges_count; r++)
+        {
+            if (yeet_range.min <= ranges[r].max && ranges[r].min <= yeet_range.max)
+            {
+                chosen[chosen_count++] = i;
+                break;
+            }
+        }
+    }
+    loco_refresh_yeet_blocks(app, yeet_buffer, &yeets, chosen, chosen_count);
+    return chosen_count;
+}
+
+//~ @lazy @sync
+// Copies up to max_count stale blocks of the sheet from their sources.
+// Returns the number copied, out_left_count gets the number still stale.
+static i32
+loco_refresh_stale_pairs(Application_Links *app, Buffer_ID yeet_buffer, i32 max_count, i32 *out_left_count)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 *chosen = push_array(scratch, i32, yeets.pairs_count);
+    i32 chosen_count = 0;
+    i32 stale_count = 0;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair pair = yeets.pairs[i];
+        if (!HasFlag(pair.flags, Loco_Pair_Flag_Stale) || HasFlag(pair.flags, Loco_Pair_Flag_Dormant)) continue;
+        stale_count += 1;
+        if (chosen_count < max_count) chosen[chosen_count++] = i;
+    }
+    loco_refresh_yeet_blocks(app, yeet_buffer, &yeets, chosen, chosen_count);
+    if (out_left_count != 0) *out_left_count = stale_count - chosen_count;
+    return chosen_count;
+}
+
+//~ @lazy @sync
+// Copies up to max_count stale blocks across all sheets, for frames without edits.
+static void
+loco_drain_stale_pairs(Application_Links *app, i32 max_count)
+{
+    bool any_left = false;
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
+    {
+        i32 left_count = 0;
+        max_count -= loco_refresh_stale_pairs(app, loco_yeet_sheets.buffers.ids[s], max_count, &left_count);
+        if (left_count > 0) any_left = true;
+    }
+    loco_yeet_stale_pending = any_left;
+}
+
+//~ @sync @chunk
+// Replaces the next chunk of the job's block with the source text at the same offset, or
+// deletes a chunk of old text past the end of the source. A job whose pair or source is
+// gone gives up and leaves the block stale.
+// Returns false once the job is finished.
+static bool
+loco_sync_job_step(Application_Links *app, Loco_Sync_Job *job)
+{
+    if (!buffer_exists(app, job->yeet_buffer)) return false;
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, job->yeet_buffer);
+    i32 pair_idx = -1;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        if (yeets.pairs[i].uid == job->uid) pair_idx = i;
+    }
+    if (pair_idx < 0) return false;
+    Loco_Marker_Pair &pair = yeets.pairs[pair_idx];
+    
+    bool is_finished = true;
+    bool is_gone = (HasFlag(pair.flags, Loco_Pair_Flag_Dormant) || !buffer_exists(app, pair.buffer));
+    i32 yeet_markers_count = 0;
+    Marker *yeet_markers = loco_get_buffer_markers(app, scratch, job->yeet_buffer, &yeet_markers_count);
+    i32 og_markers_count = 0;
+    Marker *og_markers = is_gone ? 0 : loco_get_buffer_markers(app, scratch, pair.buffer, &og_markers_count);
+    if (is_gone || pair.yeet_end_marker_idx >= yeet_markers_count || pair.end_marker_idx >= og_markers_count)
+    {
+        pair.flags = (pair.flags & ~Loco_Pair_Flag_Syncing) | Loco_Pair_Flag_Stale;
+    }
+    else
+    {
+        Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+        Range_i64 og_range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        i64 done = Min(job->done, Min(range_size(yeet_range), range_size(og_range)));
+        i64 new_size = Min(loco_yeet_sync_chunk_size, range_size(og_range) - done);
+        i64 old_size = Min(loco_yeet_sync_chunk_size, range_size(yeet_range) - done);
+        String_Const_u8 string = push_buffer_range(app, scratch, pair.buffer, Ii64(og_range.min + done, og_range.min + done + new_size));
+        loco_sync_guard_push(app, job->yeet_buffer);
+        buffer_replace_range(app, job->yeet_buffer, Ii64(yeet_range.min + done, yeet_range.min + done + old_size), string);
+        loco_sync_guard_pop(app, job->yeet_buffer);
+        job->done = done + new_size;
+        
+        is_finished = (job->done == range_size(og_range) && range_size(yeet_range) - done - old_size == 0);
+        if (!is_finished) return true;
+        pair.flags &= ~(Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale | Loco_Pair_Flag_Syncing);
+    }
+    loco_overwrite_yeets(app, job->yeet_buffer, &yeets);
+    return false;
+}
+
+//~ @sync @chunk
+// Works on the sync jobs until loco_yeet_sync_budget_us is used up, and asks for another
+// frame while any are left.
+static void
+loco_sync_jobs_tick(Application_Links *app)
+{
+    Loco_Sync_Jobs *jobs = &loco_yeet_sync_jobs;
+    if (jobs->count == 0) return;
+    u64 start_time = system_now_time();
+    i32 i = 0;
+    while (jobs->count > 0 && system_now_time() - start_time < loco_yeet_sync_budget_us)
+    {
+        i = i % jobs->count;
+        if (loco_sync_job_step(app, &jobs->jobs[i]))
+        {
+            i += 1;
+        }
+        else
+        {
+            jobs->jobs[i] = jobs->jobs[jobs->count - 1];
+            jobs->count -= 1;
+        }
+    }
+    if (jobs->count > 0)
+    {
+        animate_in_n_milliseconds(app, 0);
+    }
+}
+
+//~ @verify
+// Compares the two sides of every pair by their content hashes. A pair is only hashed again
+// if it never was or an edit touched either side since the last verify, so verifying sheets
+// that didn't change is one pass over their pairs. Diverged pairs get
+// Loco_Pair_Flag_Diverged, or with repair are marked stale to be copied from their source.
+// Lazy and dormant pairs aren't checked.
+// Returns the number of diverged pairs.
+static i32
+loco_verify_yeet_sheets(Application_Links *app, bool repair)
+{
+    i32 diverged_count = 0;
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
+    {
+        Buffer_ID yeet_buffer = loco_yeet_sheets.buffers.ids[s];
+        Scratch_Block scratch(app);
+        Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+        i32 yeet_markers_count = 0;
+        Marker *yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_markers_count);
+        Loco_Dirty_Ranges sheet_dirty = *loco_get_verify_dirty(app, yeet_buffer);
+        
+        // Grouped by source so each source's markers and dirty range are loaded once.
+        Sort_Pair_i32 *order = push_array(scratch, Sort_Pair_i32, yeets.pairs_count);
+        for (i32 i = 0; i < yeets.pairs_count; i++)
+        {
+            order[i].index = i;
+            order[i].key = (i32)yeets.pairs[i].buffer;
+        }
+        sort_pairs_by_key(order, yeets.pairs_count);
+        
+        Buffer_ID cached_buffer = 0;
+        Marker *cached_markers = 0;
+        i32 cached_markers_count = 0;
+        Loco_Dirty_Ranges source_dirty = {};
+        bool any_changed = false;
+        for (i32 o = 0; o < yeets.pairs_count; o++)
+        {
+            Loco_Marker_Pair &pair = yeets.pairs[order[o].index];
+            u32 old_flags = pair.flags;
+            pair.flags &= ~Loco_Pair_Flag_Diverged;
+            if (HasFlag(pair.flags, Loco_Pair_Flag_Lazy) || HasFlag(pair.flags, Loco_Pair_Flag_Dormant) ||
+                !buffer_exists(app, pair.buffer) || pair.yeet_end_marker_idx >= yeet_markers_count)
+            {
+                any_changed = any_changed || (pair.flags != old_flags);
+                continue;
+            }
+            if (pair.buffer != cached_buffer)
+            {
+                source_dirty = *loco_get_verify_dirty(app, pair.buffer);
+            }
+            Range_i64 og_range = loco_get_pair_source_range(app, scratch, pair, &cached_buffer, &cached_markers, &cached_markers_count);
+            Range_i64 yeet_range = loco_make_range_from_markers(yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
+            
+            bool is_touched = !HasFlag(pair.flags, Loco_Pair_Flag_Hashed);
+            Range_i64 dirty_range = {};
+            is_touched = is_touched || (loco_dirty_ranges_at(&sheet_dirty, yeet_range, &dirty_range, 0) >= 0);
+            is_touched = is_touched || (loco_dirty_ranges_at(&source_dirty, og_range, &dirty_range, 0) >= 0);
+            if (is_touched)
+            {
+                pair.source_hash = loco_hash_buffer_range(app, pair.buffer, og_range);
+                pair.yeet_hash = loco_hash_buffer_range(app, yeet_buffer, yeet_range);
+                pair.flags |= Loco_Pair_Flag_Hashed;
+                any_changed = true;
+            }
+            
+            if (range_size(og_range) != range_size(yeet_range) || pair.source_hash != pair.yeet_hash)
+            {
+                diverged_count += 1;
+                if (repair)
+                {
+                    pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+                    loco_yeet_stale_pending = true;
+                }
+                else
+                {
+                    pair.flags |= Loco_Pair_Flag_Diverged;
+                }
+            }
+            any_changed = any_changed || (pair.flags != old_flags);
+        }
+        if (any_changed)
+        {
+            loco_overwrite_yeets(app, yeet_buffer, &yeets);
+        }
+    }
+    
+    // Every sheet has seen the edits, the next verify only needs the ones after this.
+    for (Buffer_ID buffer = get_buffer_next(app, 0, Access_Always);
+         buffer != 0;
+         buffer = get_buffer_next(app, buffer, Access_Always))
+    {
+        block_zero_struct(loco_get_verify_dirty(app, buffer));
+    }
+    return diverged_count;
+}
+
+//--SESSION
+
+//~ @session @persist
+// Journals the pair table of the "*yeet*" sheet, named sheets only last for the session.
+// Unless compact is set or the journal grew too big, only the chunks that differ from the
+// ones the last save wrote are appended, with the paths they need and the active snapshot if
+// it changed, so a save costs what changed and not the sheet.
+// Blocks keep the source range they had when their chunk was written, their fingerprints
+// find them again if the text moved since.
+static bool
+loco_session_save(Application_Links *app, bool compact)
+{
+    Loco_Session_State *session = &loco_session;
+    Base_Allocator *allocator = get_base_allocator_system();
+    Buffer_ID yeet_buffer = get_buffer_by_name(app, SCu8(loco_yeet_default_sheet_name), Access_Always);
+    Loco_Pair_Table *table = 0;
+    if (buffer_exists(app, yeet_buffer))
+    {
+        table = *loco_get_yeet_pair_table(app, yeet_buffer);
+    }
+    
+    if (session->file_size == 0 ||
+        session->file_size > session->compacted_size*loco_yeet_session_compact_factor + KB(64))
+    {
+        compact = true;
+    }
+    if (!compact && table == session->saved_table && !session->active_changed) return true;
+    if (!session->has_written_paths)
+    {
+        session->written_paths = make_table_u64_u64(allocator, 64);
+        session->has_written_paths = true;
+    }
+    if (compact) table_clear(&session->written_paths);
+    Loco_Pair_Table *saved = compact ? 0 : session->saved_table;
+    
+    Scratch_Block scratch(app);
+    i32 chunks_count = (table != 0) ? table->chunks_count : 0;
+    i32 pairs_count = (table != 0) ? table->pairs_count : 0;
+    u64 max_size = sizeof(Loco_Session_File_Header) + sizeof(Loco_Session_Record)*(2 + chunks_count) +
+        sizeof(Loco_Session_Pair)*pairs_count + loco_active_yeet_snapshot.size + 8;
+    for (u32 id = 1; id < loco_path_table.count; id++)
+    {
+        max_size += sizeof(Loco_Session_Record) + loco_path_table.paths[id].size + 8;
+    }
+    u8 *image = push_array(scratch, u8, max_size);
+    u8 *at = image;
+    bool any_change = compact;
+    if (compact) at = loco_session_push_header(at);
+    if (saved == 0 || saved->pairs_count != pairs_count)
+    {
+        at = loco_session_push_record(at, Loco_Session_Record_Table, (u32)pairs_count, 0, 0, 0);
+        any_change = true;
+    }
+    
+    Buffer_ID cached_buffer = 0;
+    Marker *cached_markers = 0;
+    i32 cached_markers_count = 0;
+    i32 chunk_cap = ArrayCount(((Loco_Pair_Chunk*)0)->pairs);
+    Loco_Session_Pair *chunk_pairs = push_array(scratch, Loco_Session_Pair, chunk_cap);
+    for (i32 c = 0; c < chunks_count; c++)
+    {
+        Loco_Pair_Chunk *chunk = table->chunks[c];
+        if (saved != 0 && c < saved->chunks_count)
+        {
+            // A rebuilt chunk can hold the same pairs as the one the journal has.
+            Loco_Pair_Chunk *saved_chunk = saved->chunks[c];
+            if (saved_chunk == chunk) continue;
+            if (saved_chunk->count == chunk->count &&
+                block_match(saved_chunk->pairs, chunk->pairs, sizeof(Loco_Marker_Pair)*chunk->count)) continue;
+        }
+        
+        for (i32 i = 0; i < chunk->count; i++)
+        {
+            Loco_Marker_Pair pair = chunk->pairs[i];
+            Range_i64 range = pair.dormant_range;
+            if (!HasFlag(pair.flags, Loco_Pair_Flag_Dormant) && buffer_exists(app, pair.buffer))
+            {
+                range = loco_get_pair_source_range(app, scratch, pair, &cached_buffer, &cached_markers, &cached_markers_count);
+            }
+            
+            Loco_Session_Pair &out = chunk_pairs[i];
+            block_zero_struct(&out);
+            out.sheet_key = (i64)c*chunk_cap + i;
+            out.record.uid = pair.uid;
+            out.record.fingerprint = pair.fingerprint;
+            out.record.start = range.min;
+            out.record.end = range.max;
+            out.record.path_index = pair.file_id;
+            out.record.flags = pair.flags & (Loco_Pair_Flag_Dormant | Loco_Pair_Flag_Lazy);
+            
+            u64 written = 0;
+            if (pair.file_id != 0 && pair.file_id < loco_path_table.count &&
+                !table_read(&session->written_paths, pair.file_id, &written))
+            {
+                String_Const_u8 path = loco_path_table.paths[pair.file_id];
+                at = loco_session_push_record(at, Loco_Session_Record_Path, pair.file_id, (u32)path.size, path.str, path.size);
+                table_insert(&session->written_paths, pair.file_id, 1);
+            }
+        }
+        at = loco_session_push_record(at, Loco_Session_Record_Chunk, (u32)c, (u32)chunk->count,
+                                      chunk_pairs, sizeof(Loco_Session_Pair)*chunk->count);
+        any_change = true;
+    }
+    
+    if (compact || session->active_changed)
+    {
+        String_Const_u8 active = loco_active_yeet_snapshot;
+        at = loco_session_push_record(at, Loco_Session_Record_Active, 0, (u32)active.size, active.str, active.size);
+        any_change = true;
+    }
+    
+    bool success = true;
+    if (any_change)
+    {
+        String_Const_u8 file_path = loco_yeet_data_file_path(scratch, loco_yeet_session_file_name);
+        FILE *file = fopen((char*)file_path.str, compact ? "wb" : "ab");
+        if (file == 0) return false;
+        u64 size = (u64)(at - image);
+        success = (fwrite(image, 1, size, file) == size);
+        fclose(file);
+        if (!success) return false;
+        session->file_size = compact ? size : session->file_size + size;
+        if (compact) session->compacted_size = size;
+    }
+    
+    Loco_Pair_Table *old_saved = session->saved_table;
+    session->saved_table = loco_pair_table_retain(table);
+    loco_pair_table_release(old_saved);
+    session->active_changed = false;
+    return success;
+}
+
+//~ @session @persist
+// Replays the session journal into the yeet sheet. Only the pair records are read: every
+// block starts as a dormant placeholder, blocks from open files are bound straight away and
+// the rest once their file is opened, and a block's text is copied in once it's visible.
+static bool
+loco_session_restore(Application_Links *app)
+{
+    Scratch_Block scratch(app);
+    String_Const_u8 file_path = loco_yeet_data_file_path(scratch, loco_yeet_session_file_name);
+    FILE *file = fopen((char*)file_path.str, "rb");
+    if (file == 0) return false;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8 *image = 0;
+    bool read_ok = false;
+    if (file_size >= (long)sizeof(Loco_Session_File_Header))
+    {
+        image = push_array(scratch, u8, file_size);
+        read_ok = (fread(image, 1, file_size, file) == (size_t)file_size);
+    }
+    fclose(file);
+    if (!read_ok) return false;
+    
+    Loco_Session_Replay replay = {};
+    if (!loco_session_replay(scratch, image, (u64)file_size, &replay)) return false;
+    Table_u64_u64 file_id_from_path = make_table_u64_u64(get_base_allocator_system(), 64);
+    for (Loco_Session_Path *path = replay.first_path; path != 0; path = path->next)
+    {
+        u32 file_id = loco_intern_path(path->path);
+        table_erase(&file_id_from_path, path->path_id);
+        table_insert(&file_id_from_path, path->path_id, file_id);
+    }
+    Loco_Session_Pair *pairs = replay.pairs;
+    i32 pairs_count = replay.pairs_count;
+    String_Const_u8 active = replay.active;
+    
+    // Every pair starts dormant with a placeholder, in sheet order.
+    Loco_Marker_Pair *restored = push_array(scratch, Loco_Marker_Pair, pairs_count);
+    i32 *sorter = push_array(scratch, i32, pairs_count);
+    i64 *sheet_keys = push_array(scratch, i64, pairs_count);
+    i32 restored_count = 0;
+    for (i32 i = 0; i < pairs_count; i++)
+    {
+        Loco_Snapshot_File_Pair record = pairs[i].record;
+        u64 file_id = 0;
+        if (record.uid == 0 || !table_read(&file_id_from_path, record.path_index, &file_id)) continue;
+        
+        Loco_Marker_Pair &pair = restored[restored_count];
+        block_zero_struct(&pair);
+        pair.file_id = (u32)file_id;
+        pair.flags = Loco_Pair_Flag_Dormant | Loco_Pair_Flag_Lazy;
+        pair.uid = record.uid;
+        pair.dormant_range = Ii64(record.start, record.end);
+        pair.fingerprint = record.fingerprint;
+        if (pair.uid >= loco_yeet_next_uid) loco_yeet_next_uid = pair.uid + 1;
+        loco_mark_file_dormant(pair.file_id);
+        sorter[restored_count] = restored_count;
+        sheet_keys[restored_count] = pairs[i].sheet_key;
+        restored_count += 1;
+    }
+    table_free(&file_id_from_path);
+    loco_sort_by_key_i64(scratch, sheet_keys, sorter, restored_count);
+    
+    // Lay the sheet out like loco_load_yeet_snapshot does, in one edit.
+    String_Const_u8 placeholder = SCu8(loco_yeet_lazy_placeholder);
+    i64 block_size = (i64)placeholder.size;
+    u8 *text = push_array(scratch, u8, (block_size + 3)*restored_count);
+    Loco_Yeets yeets = {};
+    yeets.pairs = push_array(scratch, Loco_Marker_Pair, restored_count);
+    Marker *yeet_markers = push_array(scratch, Marker, restored_count*2);
+    i64 text_at = 0;
+    for (i32 j = 0; j < restored_count; j++)
+    {
+        Loco_Marker_Pair &pair = yeets.pairs[yeets.pairs_count++];
+        pair = restored[sorter[j]];
+        pair.yeet_start_marker_idx = j*2;
+        pair.yeet_end_marker_idx = j*2 + 1;
+        text[text_at++] = '\n';
+        yeet_markers[j*2 + 0].pos = text_at;
+        yeet_markers[j*2 + 0].lean_right = false;
+        block_copy(text + text_at, placeholder.str, block_size);
+        text_at += block_size;
+        yeet_markers[j*2 + 1].pos = text_at;
+        yeet_markers[j*2 + 1].lean_right = true;
+        text[text_at++] = '\n';
+        text[text_at++] = '\n';
+    }
+    
+    Buffer_ID yeet_buffer = loco_make_yeet_sheet(app, SCu8(loco_yeet_default_sheet_name));
+    loco_sync_guard_push(app, yeet_buffer);
+    buffer_replace_range(app, yeet_buffer, Ii64(0, buffer_get_size(app, yeet_buffer)), SCu8(text, text_at));
+    loco_sync_guard_pop(app, yeet_buffer);
+    loco_overwrite_buffer_markers(app, scratch, yeet_buffer, yeet_markers, restored_count*2);
+    loco_overwrite_yeets(app, yeet_buffer, &yeets);
+    
+    for (Buffer_ID buffer = get_buffer_next(app, 0, Access_Always);
+         buffer != 0;
+         buffer = get_buffer_next(app, buffer, Access_Always))
+    {
+        loco_bind_dormant_pairs(app, buffer);
+    }
+    loco_set_active_yeet_snapshot(active);
+    
+    String_Const_u8 message = push_u8_stringf(scratch, "yeet: restored %d blocks from the last session.\n", restored_count);
+    print_message(app, message);
+    return true;
+}
+
+//~ @session
+static void
+loco_session_autosave(Application_Links *app)
+{
+    if (!loco_session.is_started) return;
+    u64 now = system_now_time();
+    if (now - loco_session.last_save_time < loco_yeet_session_autosave_ms*1000) return;
+    loco_session.last_save_time = now;
+    loco_session_save(app, false);
+}
+
+//~ @api @session
+// Restores the yeet sheet of the last session and starts journaling this one.
+api(LOCO) void
+loco_on_startup(Application_Links *app)
+{
+    loco_session_restore(app);
+    loco_session.is_started = true;
+    loco_session.last_save_time = system_now_time();
+    // Start the journal over from what was restored.
+    loco_session_save(app, true);
+}
+
+//~ @api @session
+api(LOCO) void
+loco_on_exit(Application_Links *app)
+{
+    if (loco_yeet_snapshot_file_dirty) loco_write_yeet_snapshots_file(app);
+    if (loco_session.is_started)
+    {
+        loco_session_save(app, true);
+    }
+}
+
+//--ANCHOR
+
+//~ @anchor
+// Refreshes the fingerprints of this buffer's blocks in one sheet that are near the dirty range.
+static void
+loco_refresh_fingerprints(Application_Links *app, Buffer_ID yeet_buffer, Buffer_ID buffer, Range_i64 dirty_range)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 og_markers_count = 0;
+    Marker *og_markers = loco_get_buffer_markers(app, scratch, buffer, &og_markers_count);
+    bool any_changed = false;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair &pair = yeets.pairs[i];
+        if (pair.buffer != buffer || pair.end_marker_idx >= og_markers_count) continue;
+        Range_i64 range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        if (range.max + loco_yeet_anchor_context_bytes < dirty_range.min ||
+            range.min - loco_yeet_anchor_context_bytes > dirty_range.max) continue;
+        // A collapsed block is lost, keep the fingerprint it can be found with.
+        if (range_size(range) == 0 && pair.fingerprint.content_size > 0) continue;
+        
+        Loco_Fingerprint fingerprint = loco_fingerprint_buffer_range(app, buffer, range);
+        if (!block_match(&fingerprint, &pair.fingerprint, sizeof(fingerprint)))
+        {
+            pair.fingerprint = fingerprint;
+            any_changed = true;
+        }
+    }
+    if (any_changed)
+    {
+        loco_overwrite_yeets(app, yeet_buffer, &yeets);
+    }
+}
+
+//~ @anchor
+// Finds this buffer's blocks whose text no longer matches their fingerprint and searches
+// for them. First a rolling hash search for the exact block, where several matches are
+// told apart by their context and then by distance, then for what is still missing a
+// search for the block's first and last lines within loco_yeet_anchor_search_lines, in
+// case the block itself changed. The markers are written back with one overwrite and the
+// yeet blocks of the pairs that moved are refreshed with one batch edit.
+// Returns the number of blocks that moved.
+static i32
+loco_reanchor_sheet_pairs(Application_Links *app, Buffer_ID yeet_buffer, Buffer_ID buffer)
+{
+    if (loco_is_yeet_sheet(app, buffer)) return 0;
+    
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
     i32 og_markers_count = 0;
-    Marker* og_markers = loco_get_buffer_markers(app, scratch, buffer_id, &og_markers_count);
+    Marker *og_markers = loco_get_buffer_markers(app, scratch, buffer, &og_markers_count);
+    String_Const_u8 text = push_whole_buffer(app, scratch, buffer);
+    i64 text_size = (i64)text.size;
+    
+    i32 *lost = push_array(scratch, i32, yeets.pairs_count);
+    i64 *hints = push_array(scratch, i64, yeets.pairs_count);
+    i32 lost_count = 0;
     for (i32 i = 0; i < yeets.pairs_count; i++)
     {
         Loco_Marker_Pair pair = yeets.pairs[i];
-        if (pair.buffer != buffer_id) continue;
-        Range_i64 og_range = loco_make_range_from_markers(
-                                                          og_markers, pair.start_marker_idx, pair.end_marker_idx);
-        if (old_range.min > og_range.min && new_range.max < og_range.max)
+        Loco_Fingerprint fingerprint = pair.fingerprint;
+        if (pair.buffer != buffer || pair.end_marker_idx >= og_markers_count || fingerprint.content_size == 0) continue;
+        Range_i64 range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
+        if (range.max <= text_size && range_size(range) == fingerprint.content_size &&
+            loco_hash_bytes(0, text.str + range.min, range_size(range)) == fingerprint.content_hash) continue;
+        hints[lost_count] = range.min;
+        lost[lost_count++] = i;
+    }
+    if (lost_count == 0) return 0;
+    
+    Range_i64 *found = push_array(scratch, Range_i64, lost_count);
+    i32 *found_score = push_array(scratch, i32, lost_count);
+    i64 *found_distance = push_array(scratch, i64, lost_count);
+    for (i32 k = 0; k < lost_count; k++) found_score[k] = -1;
+    
+    // Exact search, one rolling pass over the text per head size. That is
+    // loco_yeet_anchor_head_size for all but the smallest blocks.
+    Sort_Pair_i32 *by_head = push_array(scratch, Sort_Pair_i32, lost_count);
+    for (i32 k = 0; k < lost_count; k++)
+    {
+        by_head[k].index = k;
+        by_head[k].key = (i32)Min(yeets.pairs[lost[k]].fingerprint.content_size, loco_yeet_anchor_head_size);
+    }
+    sort_pairs_by_key(by_head, lost_count);
+    i32 *next_with_head = push_array(scratch, i32, lost_count);
+    for (i32 group_start = 0; group_start < lost_count;)
+    {
+        i64 head_size = by_head[group_start].key;
+        i32 group_end = group_start;
+        while (group_end < lost_count && by_head[group_end].key == head_size) group_end += 1;
+        
+        Table_u64_u64 first_with_head = make_table_u64_u64(get_base_allocator_system(), (group_end - group_start)*2 + 8);
+        for (i32 g = group_start; g < group_end; g++)
         {
-            // User edited inside an original buffer block.
-            Range_i64 yeet_range = loco_make_range_from_markers(
-                                                                yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
-            String_Const_u8 string = push_buffer_range(app, scratch, buffer_id, og_range);
-            buffer_replace_range(
-                                 app, 
-                                 yeet_buffer,
-                                 yeet_range,
-                                 string
-                                 );
+            i32 k = by_head[g].index;
+            u64 head_hash = yeets.pairs[lost[k]].fingerprint.head_hash;
+            u64 first = 0;
+            next_with_head[k] = table_read(&first_with_head, head_hash, &first) ? (i32)first : -1;
+            table_erase(&first_with_head, head_hash);
+            table_insert(&first_with_head, head_hash, (u64)k);
+        }
+        
+        if (head_size > 0 && head_size <= text_size)
+        {
+            u64 top_power = 1;
+            for (i64 i = 1; i < head_size; i++) top_power *= 0x100000001b3ull;
+            u64 hash = loco_hash_bytes(0, text.str, head_size);
+            for (i64 p = 0; p + head_size <= text_size; p++)
+            {
+                if (p > 0)
+                {
+                    // Roll the window one byte on.
+                    hash -= ((u64)text.str[p - 1] + 1)*top_power;
+                    hash = hash*0x100000001b3ull + (u64)text.str[p + head_size - 1] + 1;
+                }
+                
+                u64 first = 0;
+                if (!table_read(&first_with_head, hash, &first)) continue;
+                for (i32 k = (i32)first; k >= 0; k = next_with_head[k])
+                {
+                    Loco_Fingerprint fingerprint = yeets.pairs[lost[k]].fingerprint;
+                    if (p + fingerprint.content_size > text_size) continue;
+                    if (loco_hash_bytes(0, text.str + p, fingerprint.content_size) != fingerprint.content_hash) continue;
+                    
+                    Range_i64 range = Ii64(p, p + fingerprint.content_size);
+                    Loco_Fingerprint candidate = loco_fingerprint_from_text(text, 0, range);
+                    i32 score = 2 + (candidate.before_hash == fingerprint.before_hash) + (candidate.after_hash == fingerprint.after_hash);
+                    i64 distance = (p > hints[k]) ? p - hints[k] : hints[k] - p;
+                    if (score > found_score[k] || (score == found_score[k] && distance < found_distance[k]))
+                    {
+                        found[k] = range;
+                        found_score[k] = score;
+                        found_distance[k] = distance;
+                    }
+                }
+            }
         }
+        table_free(&first_with_head);
+        group_start = group_end;
+    }
+    
+    // Line fallback for the blocks that changed.
+    i32 missing_count = 0;
+    for (i32 k = 0; k < lost_count; k++)
+    {
+        if (found_score[k] < 0) missing_count += 1;
+    }
+    if (missing_count > 0)
+    {
+        i64 line_count = 1;
+        for (i64 i = 0; i < text_size; i++)
+        {
+            if (text.str[i] == '\n') line_count += 1;
+        }
+        i64 *line_starts = push_array(scratch, i64, line_count + 1);
+        u64 *line_hashes = push_array(scratch, u64, line_count);
+        i64 line = 0;
+        line_starts[0] = 0;
+        for (i64 i = 0; i < text_size; i++)
+        {
+            if (text.str[i] == '\n')
+            {
+                line += 1;
+                line_starts[line] = i + 1;
+            }
+        }
+        line_starts[line_count] = text_size + 1;
+        for (i64 l = 0; l < line_count; l++)
+        {
+            line_hashes[l] = loco_hash_bytes(0, text.str + line_starts[l], line_starts[l + 1] - 1 - line_starts[l]);
+        }
+        
+        for (i32 k = 0; k < lost_count; k++)
+        {
+            if (found_score[k] >= 0) continue;
+            Loco_Fingerprint fingerprint = yeets.pairs[lost[k]].fingerprint;
+            
+            // Line the block was last on.
+            i64 lo = 0;
+            i64 hi = line_count;
+            while (lo < hi)
+            {
+                i64 mid = (lo + hi)/2;
+                if (line_starts[mid] <= hints[k]) lo = mid + 1;
+                else hi = mid;
+            }
+            i64 hint_line = clamp_bot(lo - 1, 0);
+            
+            // Nearest line that looks like its first line.
+            i64 first_line = -1;
+            for (i64 d = 0; d <= loco_yeet_anchor_search_lines && first_line < 0; d++)
+            {
+                if (hint_line - d < 0 && hint_line + d >= line_count) break;
+                if (hint_line - d >= 0 && line_hashes[hint_line - d] == fingerprint.first_line_hash) first_line = hint_line - d;
+                else if (hint_line + d < line_count && line_hashes[hint_line + d] == fingerprint.first_line_hash) first_line = hint_line + d;
+            }
+            if (first_line < 0) continue;
+            
+            // Nearest line to the old length that looks like its last line.
+            i64 expected_line = clamp_top(first_line + fingerprint.line_count, line_count - 1);
+            i64 last_line = expected_line;
+            i64 search_end = clamp_top(first_line + fingerprint.line_count*2 + 16, line_count - 1);
+            i64 best_distance = max_i64;
+            for (i64 l = first_line; l <= search_end; l++)
+            {
+                i64 distance = (l > expected_line) ? l - expected_line : expected_line - l;
+                if (line_hashes[l] == fingerprint.last_line_hash && distance < best_distance)
+                {
+                    last_line = l;
+                    best_distance = distance;
+                }
+            }
+            
+            i64 first_line_size = line_starts[first_line + 1] - 1 - line_starts[first_line];
+            i64 last_line_size = line_starts[last_line + 1] - 1 - line_starts[last_line];
+            Range_i64 range = {};
+            range.min = line_starts[first_line] + Min((i64)fingerprint.start_column, first_line_size);
+            range.max = line_starts[last_line] + Min((i64)fingerprint.end_column, last_line_size);
+            range.max = clamp_bot(range.max, range.min);
+            found[k] = range;
+            found_score[k] = 0;
+        }
+    }
+    
+    // Move the markers and refresh the moved blocks in the sheet. Found or not, the source
+    // text of a lost block changed without its verify hash knowing.
+    i32 *moved = push_array(scratch, i32, lost_count);
+    i32 moved_count = 0;
+    for (i32 k = 0; k < lost_count; k++)
+    {
+        Loco_Marker_Pair &pair = yeets.pairs[lost[k]];
+        pair.flags &= ~Loco_Pair_Flag_Hashed;
+        if (found_score[k] < 0) continue;
+        og_markers[pair.start_marker_idx].pos = found[k].min;
+        og_markers[pair.end_marker_idx].pos = found[k].max;
+        pair.fingerprint = loco_fingerprint_from_text(text, 0, found[k]);
+        // Copies of the pair in other sheets share the markers, they hash the range again too.
+        loco_dirty_range_note(loco_get_verify_dirty(app, buffer), found[k], found[k], true);
+        moved[moved_count++] = lost[k];
     }
-}
-
-//~ @api @buffer @edit
-api(LOCO) void 
-loco_on_buffer_edit(Application_Links *app, Buffer_ID buffer_id, Range_i64 old_range, Range_i64 new_range)
-{
-    Buffer_ID yeet_buffer = get_buffer_by_name(app, string_u8_litexpr("*yeet*"), Access_Always);
-    if (buffer_id == yeet_buffer)
+    if (moved_count > 0)
     {
-        if (!lock_yeet_buffer)
-        {
-            lock_yeet_buffer = true;
-            loco_on_yeet_buffer_edit(app, buffer_id, old_range, new_range);
-            lock_yeet_buffer = false;
-        }
+        loco_overwrite_buffer_markers(app, scratch, buffer, og_markers, og_markers_count);
+        loco_refresh_yeet_blocks(app, yeet_buffer, &yeets, moved, moved_count);
     }
-    else if (!lock_yeet_buffer)
+    else
     {
-        lock_yeet_buffer = true;
-        loco_on_original_buffer_edit(app, buffer_id, old_range, new_range);
-        lock_yeet_buffer = false;
+        loco_overwrite_yeets(app, yeet_buffer, &yeets);
     }
+    
+    String_Const_u8 unique_name = push_buffer_unique_name(app, scratch, buffer);
+    String_Const_u8 message = push_u8_stringf(scratch, "yeet: re-anchored %d blocks in %.*s, %d not found.\n", moved_count, string_expand(unique_name), lost_count - moved_count);
+    print_message(app, message);
+    return moved_count;
 }
 
-//~ @api @buffer @render
-api(LOCO) void
-loco_render_buffer(Application_Links *app, View_ID view_id, Face_ID face_id,
-                   Buffer_ID buffer, Text_Layout_ID text_layout_id,
-                   Rect_f32 rect, Frame_Info frame_info)
+//~ @anchor
+// Re-anchors this buffer's blocks in every sheet that holds them.
+static i32
+loco_reanchor_buffer_pairs(Application_Links *app, Buffer_ID buffer)
 {
-    String_Const_u8 name = string_u8_litexpr("*yeet*");
-    Buffer_ID yeet_buffer = get_buffer_by_name(app, name, Access_Always);
-    if (!buffer_exists(app, yeet_buffer)) return;
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
-    
-    if (buffer == yeet_buffer && loco_yeet_show_source_comment)
+    Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer);
+    i32 moved_count = 0;
+    for (i32 s = 0; s < source_sheets->count; s++)
     {
-        Scratch_Block scratch(app);
-        i32 markers_count = 0;
-        Marker* markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &markers_count);
-        f32 line_height = get_view_line_height(app, view_id);
-        FColor comment_color = loco_yeet_source_comment_color;
-        for (i32 i = 0; i < yeets.pairs_count; i++)
-        {
-            Loco_Marker_Pair pair = yeets.pairs[i];
-            if (!buffer_exists(app, pair.buffer)) continue;
-            
-            Range_i64 og_range = loco_get_marker_range(
-                                                       app, pair.buffer, pair.start_marker_idx, pair.end_marker_idx);
-            i64 start_line = get_line_number_from_pos(app, pair.buffer, og_range.min);
-            i64 end_line = get_line_number_from_pos(app, pair.buffer, og_range.max);
-            Fancy_Line line = {};
-            String_Const_u8 unique_name = push_buffer_unique_name(app, scratch, pair.buffer);
-            push_fancy_string(scratch, &line, fcolor_zero(), unique_name);
-            push_fancy_stringf(scratch, &line, fcolor_zero(), " - Lines: %3.lld - %3.lld", start_line, end_line);
-            i64 start_pos = markers[pair.yeet_start_marker_idx].pos;
-            Rect_f32 start_rect = text_layout_character_on_screen(app, text_layout_id, start_pos);
-            Vec2_f32 comment_pos = { start_rect.x0 + 0, start_rect.y0 - line_height };
-            draw_fancy_line(app, face_id, comment_color, &line, comment_pos);
-        }
+        moved_count += loco_reanchor_sheet_pairs(app, source_sheets->ids[s], buffer);
     }
+    return moved_count;
+}
+
+//~ @anchor
+// Does the anchor work the edit hook queued up: lost blocks are searched for first so
+// that their fingerprints aren't refreshed from the wrong text.
+static void
+loco_anchor_tick(Application_Links *app)
+{
+    if (!loco_yeet_anchor_work_pending) return;
+    loco_yeet_anchor_work_pending = false;
     
-    if (loco_yeet_show_highlight_ranges)
+    // Every source buffer of every sheet, once.
+    Scratch_Block scratch(app);
+    Table_u64_u64 seen = make_table_u64_u64(get_base_allocator_system(), 64);
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
     {
-        FColor start_color = loco_yeet_highlight_start_color;
-        FColor end_color = loco_yeet_highlight_end_color;
+        Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, loco_yeet_sheets.buffers.ids[s]);
         for (i32 i = 0; i < yeets.pairs_count; i++)
         {
-            Loco_Marker_Pair pair = yeets.pairs[i];
-            Range_i64 range = {};
-            if (pair.buffer == buffer || buffer == yeet_buffer)
+            Buffer_ID buffer = yeets.pairs[i].buffer;
+            u64 existing = 0;
+            if (buffer == 0 || table_read(&seen, (u64)buffer, &existing)) continue;
+            table_insert(&seen, (u64)buffer, 0);
+            if (!buffer_exists(app, buffer)) continue;
+            
+            Loco_Anchor_State *state = loco_get_anchor_state(app, buffer);
+            if (state->needs_reanchor)
             {
-                if (buffer == yeet_buffer)
-                {
-                    range = loco_get_marker_range(app, buffer, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
-                }
-                else
+                loco_reanchor_buffer_pairs(app, buffer);
+            }
+            if (state->has_dirty_range)
+            {
+                Loco_Buffer_Set *source_sheets = loco_get_source_sheets(app, buffer);
+                for (i32 t = 0; t < source_sheets->count; t++)
                 {
-                    range = loco_get_marker_range(app, buffer, pair.start_marker_idx, pair.end_marker_idx);
+                    loco_refresh_fingerprints(app, source_sheets->ids[t], buffer, state->dirty_range);
                 }
-                i64 start_line_number = get_line_number_from_pos(app, buffer, range.min);
-                draw_line_highlight(
-                                    app, 
-                                    text_layout_id, 
-                                    start_line_number, 
-                                    start_color);
-                i64 end_line_number = get_line_number_from_pos(app, buffer, range.max);
-                draw_line_highlight(
-                                    app, 
-                                    text_layout_id, 
-                                    end_line_number, 
-                                    end_color);
             }
+            block_zero_struct(state);
         }
     }
+    table_free(&seen);
 }
 
-//~ @api @buffer
-api(LOCO) void
-loco_on_buffer_end(Application_Links *app, Buffer_ID buffer_id)
+//~ @sheet @lazy
+// Marks the blocks of read-only sheets whose source was edited near them as stale, which
+// makes them lazy so the tick re-copies the visible ones. A block whose markers collapsed
+// is handed to the re-anchor instead. Runs before loco_anchor_tick, which resets the
+// dirty ranges this reads.
+static void
+loco_flush_read_only_sheets(Application_Links *app)
 {
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
-    for (i32 i = yeets.pairs_count - 1; i >= 0; i--)
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
     {
-        if (yeets.pairs[i].buffer == buffer_id)
+        Buffer_ID yeet_buffer = loco_yeet_sheets.buffers.ids[s];
+        Loco_Yeet_Sheet *sheet = loco_get_yeet_sheet(app, yeet_buffer);
+        if (sheet->dirty_sources.count == 0) continue;
+        
+        Scratch_Block scratch(app);
+        Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+        bool any_stale = false;
+        for (i32 d = 0; d < sheet->dirty_sources.count; d++)
+        {
+            Buffer_ID buffer = sheet->dirty_sources.ids[d];
+            if (!buffer_exists(app, buffer)) continue;
+            Loco_Anchor_State *state = loco_get_anchor_state(app, buffer);
+            if (!state->has_dirty_range) continue;
+            i32 og_markers_count = 0;
+            Marker *og_markers = loco_get_buffer_markers(app, scratch, buffer, &og_markers_count);
+            for (i32 i = 0; i < yeets.pairs_count; i++)
+            {
+                Loco_Marker_Pair &pair = yeets.pairs[i];
+                if (pair.buffer != buffer || pair.end_marker_idx >= og_markers_count) continue;
+                if (HasFlag(pair.flags, Loco_Pair_Flag_Lazy)) continue;
+                Range_i64 og_range = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
+                if (og_range.max < state->dirty_range.min || og_range.min > state->dirty_range.max) continue;
+                if (range_size(og_range) == 0 && pair.fingerprint.content_size > 0)
+                {
+                    loco_anchor_mark_lost(app, buffer);
+                    continue;
+                }
+                pair.flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+                any_stale = true;
+            }
+        }
+        sheet->dirty_sources.count = 0;
+        if (any_stale)
         {
-            loco_delete_marker_pair(app, yeet_buffer, &yeets, i);
+            loco_overwrite_yeets(app, yeet_buffer, &yeets);
+            loco_yeet_stale_pending = true;
         }
     }
 }
 
-//~
-static bool
-loco_is_cursor_inside_yeet(Application_Links *app, i64 cursor_pos, i64 *out_dst_cursor_pos, Buffer_ID *out_dst_buffer)
+//~ @api @lazy @anchor
+// Sends on the edits of the last frame, autosaves the session, makes the sheet in the active
+// view the current one, marks stale read-only blocks, re-anchors blocks that lost their
+// markers and refreshes fingerprints, catches up a sheet that just got focus, then fills in
+// the lazy blocks that the yeet views showed on their last render, or that a yeet view's
+// cursor is in. Frames without edits also copy some stale blocks, and every frame works on
+// the chunked copies of big blocks.
+api(LOCO) void
+loco_tick(Application_Links *app, Frame_Info frame_info)
 {
-    View_ID view = get_active_view(app, Access_Always);
-    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    bool is_yeet_buffer = (buffer == yeet_buffer);
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
+    bool is_idle = !loco_flush_pending_sync(app);
+    loco_session_autosave(app);
+    if (loco_yeet_snapshot_file_dirty) loco_write_yeet_snapshots_file(app);
     
-    for (i32 i = 0; i < yeets.pairs_count; i++)
+    View_ID active_view = get_active_view(app, Access_Always);
+    Buffer_ID active_buffer = view_get_buffer(app, active_view, Access_Always);
+    loco_set_current_yeet_sheet(app, active_buffer);
+    if (loco_yeet_sheets.buffers.count == 0) return;
+    
+    loco_flush_read_only_sheets(app);
+    loco_anchor_tick(app);
+    
+    if (active_buffer != loco_yeet_last_active_buffer && loco_is_yeet_sheet(app, active_buffer))
     {
-        Loco_Marker_Pair pair = yeets.pairs[i];
-        Buffer_ID src_buf = is_yeet_buffer ? yeet_buffer : pair.buffer;
-        i32 src_start = is_yeet_buffer ? pair.yeet_start_marker_idx : pair.start_marker_idx;
-        i32 src_end = is_yeet_buffer ? pair.yeet_end_marker_idx : pair.end_marker_idx;
-        Range_i64 src_range = loco_get_marker_range(app, src_buf, src_start, src_end);
-        bool is_cursor_inside = (cursor_pos >= src_range.min && cursor_pos <= src_range.max);
-        if (is_cursor_inside)
+        loco_refresh_stale_pairs(app, active_buffer, max_i32, 0);
+    }
+    loco_yeet_last_active_buffer = active_buffer;
+    
+    for (View_ID view = get_view_next(app, 0, Access_Always);
+         view != 0;
+         view = get_view_next(app, view, Access_Always))
+    {
+        Buffer_ID yeet_buffer = view_get_buffer(app, view, Access_Always);
+        Managed_Scope view_scope = view_get_managed_scope(app, view);
+        
+        // A portal closes when its view moves to another buffer or the cursor leaves the block.
+        Loco_Portal *portal = scope_attachment(app, view_scope, loco_view_portal_handle, Loco_Portal);
+        if (portal->buffer != 0)
         {
-            Buffer_ID dst_buf = !is_yeet_buffer ? yeet_buffer : pair.buffer;
-            i32 dst_start = !is_yeet_buffer ? pair.yeet_start_marker_idx : pair.start_marker_idx;
-            i32 dst_end = !is_yeet_buffer ? pair.yeet_end_marker_idx : pair.end_marker_idx;
-            Range_i64 dst_range = loco_get_marker_range(app, dst_buf, dst_start, dst_end);
-            if (out_dst_cursor_pos != 0)
+            Scratch_Block scratch(app);
+            i64 cursor_pos = view_get_cursor_pos(app, view);
+            i32 markers_count = 0;
+            Marker *markers = loco_get_buffer_markers(app, scratch, portal->buffer, &markers_count);
+            bool is_open = (portal->buffer == yeet_buffer && portal->end_marker_idx < markers_count && portal->start_marker_idx < markers_count);
+            if (is_open)
             {
-                *out_dst_cursor_pos = dst_range.min + (cursor_pos - src_range.min);
+                Range_i64 portal_range = loco_make_range_from_markers(markers, portal->start_marker_idx, portal->end_marker_idx);
+                is_open = (cursor_pos >= portal_range.min && cursor_pos <= portal_range.max);
             }
-            if (out_dst_buffer != 0)
+            if (!is_open)
             {
-                *out_dst_buffer = dst_buf;
+                block_zero_struct(portal);
             }
-            return true;
         }
+        
+        if (!loco_is_yeet_sheet(app, yeet_buffer) || loco_get_yeet_sheet(app, yeet_buffer)->is_portal) continue;
+        Range_i64 *visible_range = scope_attachment(app, view_scope, loco_view_visible_range_handle, Range_i64);
+        Range_i64 ranges[2];
+        ranges[0] = *visible_range;
+        ranges[1] = Ii64(view_get_cursor_pos(app, view));
+        loco_materialize_lazy_pairs(app, yeet_buffer, ranges, 2);
     }
     
-    return false;
-}
-
-//~ @jump @buffer
-static void
-loco_jump_to_buffer(Application_Links *app, Buffer_ID dst_buffer, i64 dst_cursor)
-{
-    View_ID view = get_next_view_after_active(app, Access_Always);
-    view_set_buffer(app, view, dst_buffer, 0);
-    view_set_active(app, view);
-    view_set_cursor_and_preferred_x(app, view, seek_pos(dst_cursor));
-    if (auto_center_after_jumps)
+    if (loco_yeet_stale_pending)
     {
-        center_view(app);
+        if (is_idle) loco_drain_stale_pairs(app, loco_yeet_idle_drain_count);
+        if (loco_yeet_stale_pending) animate_in_n_milliseconds(app, loco_yeet_idle_drain_ms);
     }
+    loco_sync_jobs_tick(app);
 }
 
-//~ @jump
-static bool
-loco_try_jump_between_yeet_pair(Application_Links *app)
+//~ @buffer
+static void
+loco_yeet_buffer_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
 {
-    View_ID view = get_active_view(app, Access_Always);
-    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
-    i64 cursor_pos = view_get_cursor_pos(app, view);
-    i64 dst_cursor_pos = 0;
-    Buffer_ID dst_buffer = 0;
-    bool success = loco_is_cursor_inside_yeet(app, cursor_pos, &dst_cursor_pos, &dst_buffer);
-    if (success)
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    if (loco_is_yeet_sheet(app, buffer) || loco_find_yeet_at(app, yeet_buffer, buffer, range.min, 0, 0, 0))
     {
-        loco_jump_to_buffer(app, dst_buffer, dst_cursor_pos);
+        return;
     }
-    return success;
-}
-
-//~ @buffer
-// Copies text region from one buffer to another buffer (appends to end)
-// Returns the insertion region in the dest buffer.
-static Range_i64
-loco_copy_buffer_text_to_buffer(Application_Links *app, 
-                                Arena * arena, 
-                                Buffer_ID src_buffer, 
-                                Buffer_ID dst_buffer, 
-                                Range_i64 src_range)
-{
+    
+    i32 old_marker_idx = loco_append_marker_range(app, buffer, range);
+    
     // Copy range string from original buffer.
-    String_Const_u8 copy_string = push_buffer_range(app, arena, src_buffer, src_range);
+    Scratch_Block scratch(app);
     
-    // Find dest buffer pos to start insertion.
-    i64 dst_insert_start = (i64)buffer_get_size(app, dst_buffer);
+    // A portal sheet only gets a stand-in for the block.
+    bool is_portal = loco_get_yeet_sheet(app, yeet_buffer)->is_portal;
+    u32 pair_flags = 0;
+    Range_i64 insertion_range = {};
+    if (is_portal)
+    {
+        insertion_range = loco_append_block_to_buffer(app, scratch, yeet_buffer, SCu8(loco_yeet_portal_placeholder));
+    }
+    else
+    {
+        bool is_complete = true;
+        insertion_range = loco_copy_buffer_text_to_buffer(app, scratch, buffer, yeet_buffer, range, &is_complete);
+        if (!is_complete)
+        {
+            // The idle drain copies it again.
+            pair_flags |= Loco_Pair_Flag_Lazy | Loco_Pair_Flag_Stale;
+            loco_yeet_stale_pending = true;
+        }
+    }
     
-    // Insert range to yeet buffer.
-    lock_yeet_buffer = true;
-    Buffer_Insertion insert = begin_buffer_insertion_at_buffered(app, dst_buffer, dst_insert_start, arena, KB(16));
-    insertc(&insert, '\n');
-    insert_string(&insert, copy_string);
-    insertc(&insert, '\n');
-    insertc(&insert, '\n');
-    end_buffer_insertion(&insert);
-    lock_yeet_buffer = false;
+    i32 old_yeet_marker_idx = loco_append_marker_range(app, yeet_buffer, insertion_range);
     
-    // Find dest end buffer pos.
-    i64 dst_insert_end = (i64)buffer_get_size(app, dst_buffer);
+    // Show the yeet buffer in opposite view.
+    View_ID yeet_view = get_next_view_after_active(app, Access_Always);
+    view_set_buffer(app, yeet_view, yeet_buffer, 0);
+    view_set_cursor_and_preferred_x(app, yeet_view, seek_pos(insertion_range.min));
+    if (loco_yeet_make_yeet_buffer_active_on_yeet)
+    {
+        view_set_active(app, yeet_view);
+    }
     
-    // +1 to ignore start newline.
-    // -2 to ignore the two end newlines.
-    return Ii64(dst_insert_start + 1, dst_insert_end - 2);
-}
-
-//~ @marker @append
-// Append two markers that sit and the start and end of a range.
-static i32
-loco_append_marker_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
-{
-    Marker markers[2];
-    markers[0].pos = range.min; 
-    markers[0].lean_right = false;
-    markers[1].pos = range.max;
-    markers[1].lean_right = true;
-    return loco_append_markers(app, buffer, markers, 2);
-}
-
-//~ @snapshot
-static void
-loco_save_yeet_snapshot_to_slot(Application_Links *app, i32 slot)
-{
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
-    yeets_snapshots.snapshots[slot] = yeets;
+    // add marker pair to yeet table.
+    Loco_Marker_Pair pair = {};
+    pair.buffer = buffer;
+    pair.file_id = loco_buffer_file_id(app, buffer);
+    pair.uid = loco_yeet_next_uid++;
+    pair.fingerprint = loco_fingerprint_buffer_range(app, buffer, range);
+    pair.start_marker_idx = old_marker_idx;
+    pair.end_marker_idx = old_marker_idx + 1;
+    pair.yeet_start_marker_idx = old_yeet_marker_idx;
+    pair.yeet_end_marker_idx = old_yeet_marker_idx + 1;
+    pair.flags = pair_flags;
+    if (is_portal) pair.flags |= Loco_Pair_Flag_Lazy;
+    loco_append_yeet_pairs(app, yeet_buffer, &pair, 1);
 }
 
-//~ @snapshot
-static void
-loco_load_yeet_snapshot_from_slot(Application_Links *app, i32 slot)
+//~ @buffer @batch
+// Yeets a list of ranges from one buffer in one go. The text for every range is
+// built in a single arena pass and inserted with one edit, then the markers for
+// both buffers and the new pairs are each appended once.
+// Ranges that start inside an existing yeet are skipped, like loco_yeet_buffer_range.
+// Within the batch, ranges that overlap or touch are merged into one, so no two blocks
+// share text. Ranges whose text can't be read are skipped with a message.
+// Returns the number of ranges that were yeeted.
+static i64
+loco_yeet_buffer_ranges(Application_Links *app, Buffer_ID buffer, Loco_Range_List *ranges)
 {
     Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    loco_yeet_clear(app);
-    Loco_Yeets unsorted_yeets = yeets_snapshots.snapshots[slot];
+    if (loco_is_yeet_sheet(app, buffer) || ranges->count == 0) return 0;
     
     Scratch_Block scratch(app);
     
-    // Sort the pairs by the yeet_buffer marker index.
-    Sort_Pair_i32* yeet_sorter = push_array(scratch, Sort_Pair_i32, unsorted_yeets.pairs_count);
-    for (i32 i = 0; i < unsorted_yeets.pairs_count; i += 1){
-        yeet_sorter[i].index = i;
-        yeet_sorter[i].key = unsorted_yeets.pairs[i].yeet_start_marker_idx;
+    // Gather the ranges that are already yeeted from this buffer, sorted by start,
+    // with a running max of their ends so containment is a binary search.
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    i32 og_markers_count = 0;
+    Marker* og_markers = loco_get_buffer_markers(app, scratch, buffer, &og_markers_count);
+    Range_i64 *existing = push_array(scratch, Range_i64, yeets.pairs_count);
+    i64 existing_count = 0;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        Loco_Marker_Pair pair = yeets.pairs[i];
+        if (pair.buffer != buffer || pair.end_marker_idx >= og_markers_count) continue;
+        existing[existing_count++] = loco_make_range_from_markers(og_markers, pair.start_marker_idx, pair.end_marker_idx);
     }
-    sort_pairs_by_key(yeet_sorter, unsorted_yeets.pairs_count);
-    
-    Loco_Yeets yeets = {};
-    yeets.pairs_count = unsorted_yeets.pairs_count;
-    for (i32 i = 0; i < unsorted_yeets.pairs_count; i += 1) {
-        yeets.pairs[i] = unsorted_yeets.pairs[yeet_sorter[i].index];
+    loco_sort_ranges_by_min(existing, existing_count);
+    i64 *existing_max = push_array(scratch, i64, existing_count);
+    for (i64 i = 0; i < existing_count; i++)
+    {
+        existing_max[i] = existing[i].max;
+        if (i > 0 && existing_max[i - 1] > existing_max[i]) existing_max[i] = existing_max[i - 1];
     }
     
-    // Delete all mentions of buffers that no longer exist.
-    for (i32 i = yeets.pairs_count - 1; i >= 0; i--)
+    // Filter the new ranges and size the insertion.
+    bool is_portal = loco_get_yeet_sheet(app, yeet_buffer)->is_portal;
+    String_Const_u8 placeholder = SCu8(loco_yeet_portal_placeholder);
+    Range_i64 *accepted = push_array(scratch, Range_i64, ranges->count);
+    i64 accepted_count = 0;
+    i64 text_size = 0;
+    i64 buffer_size = buffer_get_size(app, buffer);
+    for (Loco_Range_Node *node = ranges->first; node != 0; node = node->next)
     {
-        if (!buffer_exists(app, yeets.pairs[i].buffer))
+        Range_i64 range = node->range;
+        if (range.min < 0 || range.max > buffer_size || range.min > range.max) continue;
+        
+        // Last existing range starting at or before range.min.
+        i64 lo = 0;
+        i64 hi = existing_count;
+        while (lo < hi)
         {
-            // Swap delete.
-            yeets.pairs[i] = yeets.pairs[yeets.pairs_count-1];
-            yeets.pairs_count -= 1;
+            i64 mid = (lo + hi)/2;
+            if (existing[mid].min <= range.min) lo = mid + 1;
+            else hi = mid;
         }
+        if (lo > 0 && existing_max[lo - 1] >= range.min) continue;
+        
+        accepted[accepted_count++] = range;
     }
     
-    // Insert the text into the yeet_buffer.
-    for (i32 i = 0; i < yeets.pairs_count; i++)
+    // Ranges from the same batch may overlap, e.g. a declaration's first line that holds
+    // the end of the scope before it, or nested scopes. They become one block, and so do
+    // ranges that touch, as both blocks would take text typed between them.
+    loco_sort_ranges_by_min(accepted, accepted_count);
+    i64 kept_count = 0;
+    for (i64 i = 0; i < accepted_count; i++)
     {
-        Loco_Marker_Pair pair = yeets.pairs[i];
-        Range_i64 og_range = loco_get_marker_range(app, pair.buffer, pair.start_marker_idx, pair.end_marker_idx);
-        Range_i64 insertion_range = loco_copy_buffer_text_to_buffer(app, scratch, pair.buffer, yeet_buffer, og_range);
-        loco_append_marker_range(app, yeet_buffer, insertion_range);
+        Range_i64 range = accepted[i];
+        if (kept_count > 0 && range.min <= accepted[kept_count - 1].max)
+        {
+            Range_i64 &prev = accepted[kept_count - 1];
+            prev.max = Max(prev.max, range.max);
+            continue;
+        }
+        accepted[kept_count++] = range;
+    }
+    accepted_count = kept_count;
+    if (accepted_count == 0) return 0;
+    for (i64 i = 0; i < accepted_count; i++)
+    {
+        // "\n" + text + "\n\n", the same layout loco_copy_buffer_text_to_buffer uses.
+        text_size += (is_portal ? (i64)placeholder.size : range_size(accepted[i])) + 3;
     }
     
-    loco_overwrite_yeets(app, yeet_buffer, &yeets);
-    
-    // Show the yeet buffer in opposite view if not in yeet view already.
-    View_ID view = get_active_view(app, Access_Always);
-    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
-    if (buffer != yeet_buffer)
+    // Build all the text in one pass.
+    i64 dst_insert_start = (i64)buffer_get_size(app, yeet_buffer);
+    u8 *text = push_array(scratch, u8, text_size);
+    Marker *new_og_markers = push_array(scratch, Marker, accepted_count*2);
+    Marker *new_yeet_markers = push_array(scratch, Marker, accepted_count*2);
+    i64 at = 0;
+    i64 built_count = 0;
+    i64 unread_count = 0;
+    for (i64 r = 0; r < accepted_count; r++)
     {
-        View_ID yeet_view = get_next_view_after_active(app, Access_Always);
-        view_set_buffer(app, yeet_view, yeet_buffer, 0);
-        view_set_cursor_and_preferred_x(app, yeet_view, seek_pos(0));
+        Range_i64 range = accepted[r];
+        i64 size = range_size(range);
+        if (is_portal)
+        {
+            size = (i64)placeholder.size;
+            block_copy(text + at + 1, placeholder.str, size);
+        }
+        else if (!buffer_read_range(app, buffer, range, text + at + 1))
+        {
+            // Skipped rather than filling the block with whatever the scratch held.
+            unread_count += 1;
+            continue;
+        }
+        text[at++] = '\n';
+        i64 i = built_count++;
+        accepted[i] = range;
+        
+        new_og_markers[i*2 + 0].pos = range.min;
+        new_og_markers[i*2 + 0].lean_right = false;
+        new_og_markers[i*2 + 1].pos = range.max;
+        new_og_markers[i*2 + 1].lean_right = true;
+        new_yeet_markers[i*2 + 0].pos = dst_insert_start + at;
+        new_yeet_markers[i*2 + 0].lean_right = false;
+        new_yeet_markers[i*2 + 1].pos = dst_insert_start + at + size;
+        new_yeet_markers[i*2 + 1].lean_right = true;
+        
+        at += size;
+        text[at++] = '\n';
+        text[at++] = '\n';
     }
-}
-
-//~ @buffer
-static void
-loco_yeet_buffer_range(Application_Links *app, Buffer_ID buffer, Range_i64 range)
-{
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
-    if (buffer == yeet_buffer || loco_is_cursor_inside_yeet(app, range.min, 0, 0))
+    accepted_count = built_count;
+    if (unread_count > 0)
     {
-        return;
+        String_Const_u8 message = push_u8_stringf(scratch, "yeet: %lld ranges couldn't be read and were skipped.\n", unread_count);
+        print_message(app, message);
     }
+    if (accepted_count == 0) return 0;
     
-    i32 old_marker_idx = loco_append_marker_range(app, buffer, range);
-    
-    // Copy range string from original buffer.
-    Scratch_Block scratch(app);
+    // One edit for the whole batch.
+    loco_sync_guard_push(app, yeet_buffer);
+    buffer_replace_range(app, yeet_buffer, Ii64(dst_insert_start), SCu8(text, at));
+    loco_sync_guard_pop(app, yeet_buffer);
     
-    Range_i64 insertion_range = loco_copy_buffer_text_to_buffer(app, scratch, buffer, yeet_buffer, range);
+    i32 first_og_marker_idx = loco_append_markers(app, buffer, new_og_markers, (i32)accepted_count*2);
+    i32 first_yeet_marker_idx = loco_append_markers(app, yeet_buffer, new_yeet_markers, (i32)accepted_count*2);
     
-    i32 old_yeet_marker_idx = loco_append_marker_range(app, yeet_buffer, insertion_range);
+    u32 file_id = loco_buffer_file_id(app, buffer);
+    Loco_Marker_Pair *new_pairs = push_array(scratch, Loco_Marker_Pair, accepted_count);
+    for (i64 i = 0; i < accepted_count; i++)
+    {
+        Loco_Marker_Pair &pair = new_pairs[i];
+        block_zero_struct(&pair);
+        pair.buffer = buffer;
+        pair.file_id = file_id;
+        pair.uid = loco_yeet_next_uid++;
+        pair.fingerprint = loco_fingerprint_buffer_range(app, buffer, accepted[i]);
+        pair.start_marker_idx = first_og_marker_idx + (i32)i*2;
+        pair.end_marker_idx = pair.start_marker_idx + 1;
+        pair.yeet_start_marker_idx = first_yeet_marker_idx + (i32)i*2;
+        pair.yeet_end_marker_idx = pair.yeet_start_marker_idx + 1;
+        if (is_portal) pair.flags |= Loco_Pair_Flag_Lazy;
+    }
+    loco_append_yeet_pairs(app, yeet_buffer, new_pairs, (i32)accepted_count);
     
     // Show the yeet buffer in opposite view.
     View_ID yeet_view = get_next_view_after_active(app, Access_Always);
     view_set_buffer(app, yeet_view, yeet_buffer, 0);
-    view_set_cursor_and_preferred_x(app, yeet_view, seek_pos(insertion_range.min));
+    view_set_cursor_and_preferred_x(app, yeet_view, seek_pos(new_yeet_markers[0].pos));
     if (loco_yeet_make_yeet_buffer_active_on_yeet)
     {
         view_set_active(app, yeet_view);
     }
     
-    // add marker pair to yeet table.
-    Managed_Scope yeet_scope = buffer_get_managed_scope(app, yeet_buffer);
-    Managed_Object* pair_obj = scope_attachment(app, yeet_scope, loco_marker_pair_handle, Managed_Object);
-    Loco_Yeets yeets = {};
-    if (!managed_object_load_data(app, *pair_obj, 0, 1, &yeets))
-    {
-        yeets.pairs_count = 0;
-        *pair_obj = alloc_managed_memory_in_scope(app, yeet_scope, sizeof(Loco_Yeets), 1);
-    }
-    Loco_Marker_Pair& pair = yeets.pairs[yeets.pairs_count++];
-    pair.buffer = buffer;
-    pair.start_marker_idx = old_marker_idx;
-    pair.end_marker_idx = old_marker_idx + 1;
-    pair.yeet_start_marker_idx = old_yeet_marker_idx;
-    pair.yeet_end_marker_idx = old_yeet_marker_idx + 1;
-    managed_object_store_data(app, *pair_obj, 0, 1, &yeets);
+    return accepted_count;
 }
 
 //~ @command
@@ -739,7 +5290,9 @@ CUSTOM_DOC("Yeets some code into a yeet buffer.")
     if (loco_try_jump_between_yeet_pair(app))
         return;
     
+    loco_yeet_history_begin(app);
     loco_yeet_buffer_range(app, buffer, range);
+    loco_yeet_history_end(app);
 }
 
 //~ @command
@@ -748,41 +5301,91 @@ CUSTOM_DOC("Selects the surrounding function scope and yeets it.")
 { 
     View_ID view = get_active_view(app, Access_ReadVisible);
     Buffer_ID buffer = view_get_buffer(app, view, Access_ReadVisible);
-    // Select the surrounding {} braces.
+    // Select the outermost scope around the cursor, from the start of its declaration.
     i64 pos = view_get_cursor_pos(app, view);
-    Range_i64 range = {};
-    if (find_surrounding_nest(app, buffer, pos, FindNest_Scope, &range)){
-        for (;;){
-            pos = range.min;
-            if (!find_surrounding_nest(app, buffer, pos, FindNest_Scope, &range)){
-                break;
-            }
+    Loco_Nest nest = {};
+    if (!loco_nest_index_find(app, buffer, pos, &nest))
+    {
+        print_message(app, string_u8_litexpr("yeet: the cursor isn't inside a scope.\n"));
+        return;
+    }
+    Range_i64 range = loco_nest_yeet_range(app, buffer, &nest);
+    select_scope(app, view, range);
+    // yeet it.
+    loco_yeet_selected_range_or_jump(app);
+}
+
+//~ @command
+CUSTOM_COMMAND_SIG(loco_yeet_outline)
+CUSTOM_DOC("Yeets every top level function and struct in the current buffer in one batch.")
+{
+    View_ID view = get_active_view(app, Access_ReadVisible);
+    Buffer_ID buffer = view_get_buffer(app, view, Access_ReadVisible);
+    Loco_Nest_Index *index = loco_nest_index_refresh(app, buffer);
+    if (index == 0 || !index->is_valid) return;
+    
+    Scratch_Block scratch(app);
+    Loco_Range_List ranges = {};
+    for (i32 i = 0; i < index->nests_count; i++)
+    {
+        Loco_Nest *nest = &index->nests[i];
+        if (nest->kind == Loco_Nest_Kind_Function || nest->kind == Loco_Nest_Kind_Struct)
+        {
+            loco_range_list_push(scratch, &ranges, loco_nest_yeet_range(app, buffer, nest));
         }
-        i64 start_line = get_line_number_from_pos(app, buffer, range.min);
-        start_line -= 2;
-        if (start_line < 1) start_line = 1;
-        range = Ii64(get_line_start_pos(app, buffer, start_line), range.max);
-        select_scope(app, view, range);
     }
-    // yeet it.
-    loco_yeet_selected_range_or_jump(app);
+    
+    // One insertion for the whole outline, scopes already in the sheet are skipped.
+    loco_yeet_history_begin(app);
+    loco_yeet_buffer_ranges(app, buffer, &ranges);
+    loco_yeet_history_end(app);
 }
 
-//~ @command
-CUSTOM_COMMAND_SIG(loco_yeet_clear)
-CUSTOM_DOC("Clears all yeets.")
+//~ @command @anchor
+CUSTOM_COMMAND_SIG(loco_yeet_reanchor)
+CUSTOM_DOC("Searches for the yeet blocks whose source text no longer matches, in the current buffer or in every source buffer from the yeet sheet.")
 {
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    View_ID view = get_active_view(app, Access_Always);
+    Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
+    if (!loco_is_yeet_sheet(app, buffer))
+    {
+        loco_reanchor_buffer_pairs(app, buffer);
+        return;
+    }
     
-    Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
+    Buffer_ID yeet_buffer = buffer;
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
+    Sort_Pair_i32 *by_buffer = push_array(scratch, Sort_Pair_i32, yeets.pairs_count);
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        by_buffer[i].index = i;
+        by_buffer[i].key = yeets.pairs[i].buffer;
+    }
+    sort_pairs_by_key(by_buffer, yeets.pairs_count);
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        if (i > 0 && by_buffer[i - 1].key == by_buffer[i].key) continue;
+        if (buffer_exists(app, by_buffer[i].key)) loco_reanchor_sheet_pairs(app, yeet_buffer, by_buffer[i].key);
+    }
+}
+
+//~
+static void
+loco_clear_yeet_sheet(Application_Links *app, Buffer_ID yeet_buffer)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
     if (loco_yeets_delete_og_markers)
     {
         for (i32 i = 0; i < yeets.pairs_count; i++)
         {
+            if (!buffer_exists(app, yeets.pairs[i].buffer)) continue;
             Managed_Scope scope = buffer_get_managed_scope(app, yeets.pairs[i].buffer);
             Managed_Object* markers_obj = scope_attachment(
                                                            app, scope, loco_marker_handle, Managed_Object);
             managed_object_free(app, *markers_obj);
+            *markers_obj = 0;
         }
     }
     
@@ -790,28 +5393,62 @@ CUSTOM_DOC("Clears all yeets.")
         Managed_Scope scope = buffer_get_managed_scope(app, yeet_buffer);
         Managed_Object* markers_obj = scope_attachment(app, scope, loco_marker_handle, Managed_Object);
         managed_object_free(app, *markers_obj);
-        Managed_Object* pair_obj = scope_attachment(app, scope, loco_marker_pair_handle, Managed_Object);
-        managed_object_free(app, *pair_obj);
+        *markers_obj = 0;
+        Loco_Pair_Table **live_table = loco_get_yeet_pair_table(app, yeet_buffer);
+        loco_reindex_sheet_sources(app, yeet_buffer, *live_table, 0);
+        loco_pair_table_release(*live_table);
+        *live_table = 0;
     }
     
     clear_buffer(app, yeet_buffer);
 }
 
+//~ @command
+CUSTOM_COMMAND_SIG(loco_yeet_clear)
+CUSTOM_DOC("Clears all yeets in the current sheet.")
+{
+    loco_yeet_history_begin(app);
+    loco_clear_yeet_sheet(app, loco_get_yeet_buffer(app));
+    loco_yeet_history_end(app);
+}
+
 //~ @command
 CUSTOM_COMMAND_SIG(loco_yeet_reset_all)
-CUSTOM_DOC("Clears all yeets in all snapshots, also clears all the markers.")
+CUSTOM_DOC("Clears all yeets in all sheets and snapshots, also clears all the markers.")
 {
+    loco_ensure_yeet_snapshots_file_loaded(app);
+    
+    // Free the source markers behind every snapshot, then clear the sheets and their markers.
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        Loco_Pair_Table *table = snapshot->table;
+        if (table == 0) continue;
+        for (i32 c = 0; c < table->chunks_count; c++)
+        {
+            Loco_Pair_Chunk *chunk = table->chunks[c];
+            for (i32 i = 0; i < chunk->count; i++)
+            {
+                Loco_Marker_Pair pair = chunk->pairs[i];
+                if (HasFlag(pair.flags, Loco_Pair_Flag_Dormant) || !buffer_exists(app, pair.buffer)) continue;
+                Managed_Scope scope = buffer_get_managed_scope(app, pair.buffer);
+                Managed_Object* markers_obj = scope_attachment(app, scope, loco_marker_handle, Managed_Object);
+                managed_object_free(app, *markers_obj);
+                *markers_obj = 0;
+            }
+        }
+    }
+    
     bool cache_delete_og_markers = loco_yeets_delete_og_markers;
     loco_yeets_delete_og_markers = true;
-    loco_load_yeet_snapshot_from_slot(app, 0);
-    loco_yeet_clear(app);
-    loco_load_yeet_snapshot_from_slot(app, 1);
-    loco_yeet_clear(app);
-    loco_load_yeet_snapshot_from_slot(app, 2);
-    loco_yeet_clear(app);
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
+    {
+        Buffer_ID sheet = loco_yeet_sheets.buffers.ids[s];
+        loco_clear_yeet_sheet(app, sheet);
+        loco_yeet_history_clear(&loco_get_yeet_sheet(app, sheet)->history);
+    }
     loco_yeets_delete_og_markers = cache_delete_og_markers;
-    loco_load_yeet_snapshot_from_slot(app, 0);
-    yeets_snapshots = {};
+    loco_free_yeet_snapshots();
+    loco_yeet_snapshot_file_dirty = true;
 }
 
 //~ @command
@@ -819,7 +5456,6 @@ CUSTOM_COMMAND_SIG(loco_yeet_remove_marker_pair)
 CUSTOM_DOC("Removes the marker pair the cursor is currently inside.")
 {
     
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
     View_ID view = get_active_view(app, Access_Always);
     Buffer_ID buffer = view_get_buffer(app, view, Access_Always);
     i64 cursor_pos = view_get_cursor_pos(app, view);
@@ -828,20 +5464,22 @@ CUSTOM_DOC("Removes the marker pair the cursor is currently inside.")
     // If we're in the original buffer,
     // try to jump to the relative location in the yeet before.
     // That way I just keep the one branch of logic for deleting
-    // from the yeet buffer only.
+    // from the yeet buffer only. The jump makes its sheet the current one.
     View_ID cached_view = view;
-    if (buffer != yeet_buffer)
+    if (!loco_is_yeet_sheet(app, buffer))
     {
         loco_try_jump_between_yeet_pair(app);
         view = get_active_view(app, Access_Always);
         buffer = view_get_buffer(app, view, Access_Always);
     }
     
-    if (buffer == yeet_buffer)
+    if (loco_is_yeet_sheet(app, buffer))
     {
+        Buffer_ID yeet_buffer = buffer;
+        loco_set_current_yeet_sheet(app, yeet_buffer);
         Scratch_Block scratch(app);
         Range_i64 range = get_view_range(app, view);
-        Loco_Yeets yeets = loco_get_buffer_yeets(app, yeet_buffer);
+        Loco_Yeets yeets = loco_get_buffer_yeets(app, scratch, yeet_buffer);
         i32 yeet_marker_count = 0;
         Marker* yeet_markers = loco_get_buffer_markers(app, scratch, yeet_buffer, &yeet_marker_count);
         for (i32 i = yeets.pairs_count - 1; i >= 0; i--)
@@ -851,7 +5489,9 @@ CUSTOM_DOC("Removes the marker pair the cursor is currently inside.")
                                                                 yeet_markers, pair.yeet_start_marker_idx, pair.yeet_end_marker_idx);
             if (range.max > yeet_range.min && range.max < yeet_range.max)
             {
+                loco_yeet_history_begin(app);
                 loco_delete_marker_pair(app, yeet_buffer, &yeets, i);
+                loco_yeet_history_end(app);
                 break;
             }
         }
@@ -862,46 +5502,493 @@ CUSTOM_DOC("Removes the marker pair the cursor is currently inside.")
 
 //--SNAPSHOTS
 
+//~ @snapshot
+// Lists the snapshots by name, returns 0 if the user cancels or there are none.
+// With with_live the yeet sheet is listed too, as loco_live_yeet_snapshot.
+static Loco_Yeet_Snapshot*
+loco_get_yeet_snapshot_from_user(Application_Links *app, char *query, bool with_live)
+{
+    loco_ensure_yeet_snapshots_file_loaded(app);
+    if (yeets_snapshots.count == 0 && !with_live)
+    {
+        print_message(app, string_u8_litexpr("yeet: there are no snapshots.\n"));
+        return 0;
+    }
+    
+    Scratch_Block scratch(app);
+    Lister_Block lister(app, scratch);
+    lister_set_query(lister, query);
+    lister_set_default_handlers(lister);
+    Loco_Pair_Table *live_table = *loco_get_yeet_pair_table(app, loco_get_yeet_buffer(app));
+    if (with_live)
+    {
+        i32 pairs_count = (live_table != 0) ? live_table->pairs_count : 0;
+        String_Const_u8 status = push_u8_stringf(scratch, "%d yeets (sheet)", pairs_count);
+        lister_add_item(lister, loco_live_yeet_snapshot.name, status, &loco_live_yeet_snapshot, 0);
+    }
+    for (Loco_Yeet_Snapshot *snapshot = yeets_snapshots.first; snapshot != 0; snapshot = snapshot->next)
+    {
+        i32 pairs_count = (snapshot->table != 0) ? snapshot->table->pairs_count : 0;
+        bool is_active = string_match(snapshot->name, loco_active_yeet_snapshot);
+        String_Const_u8 status = push_u8_stringf(scratch, "%d yeets%s", pairs_count, is_active ? " (active)" : "");
+        lister_add_item(lister, snapshot->name, status, snapshot, 0);
+    }
+    Lister_Result l_result = run_lister(app, lister);
+    if (l_result.canceled) return 0;
+    // The sheet is only borrowed for as long as the command runs.
+    loco_live_yeet_snapshot.table = live_table;
+    return (Loco_Yeet_Snapshot*)l_result.user_data;
+}
+
+//~ @snapshot
+static void
+loco_load_yeet_snapshot_by_name(Application_Links *app, String_Const_u8 name)
+{
+    loco_ensure_yeet_snapshots_file_loaded(app);
+    Loco_Yeet_Snapshot *snapshot = loco_find_yeet_snapshot(name);
+    if (snapshot != 0)
+    {
+        loco_yeet_history_begin(app);
+        loco_load_yeet_snapshot(app, snapshot);
+        loco_yeet_history_end(app);
+    }
+}
+
+//~ @command @snapshot
+CUSTOM_COMMAND_SIG(loco_save_yeet_snapshot_as)
+CUSTOM_DOC("Queries for a name and saves the yeets to a snapshot with that name.")
+{
+    u8 space[256];
+    String_Const_u8 name = get_query_string(app, "Snapshot name: ", space, sizeof(space));
+    if (name.size == 0) return;
+    loco_save_yeet_snapshot(app, name);
+}
+
+//~ @command @snapshot
+CUSTOM_COMMAND_SIG(loco_switch_yeet_snapshot)
+CUSTOM_DOC("Lists the yeet snapshots and loads the chosen one into the yeet buffer.")
+{
+    Loco_Yeet_Snapshot *snapshot = loco_get_yeet_snapshot_from_user(app, "Load snapshot:", false);
+    if (snapshot != 0)
+    {
+        loco_yeet_history_begin(app);
+        loco_load_yeet_snapshot(app, snapshot);
+        loco_yeet_history_end(app);
+    }
+}
+
+//~ @command @snapshot
+CUSTOM_COMMAND_SIG(loco_delete_yeet_snapshot)
+CUSTOM_DOC("Lists the yeet snapshots and deletes the chosen one.")
+{
+    Loco_Yeet_Snapshot *snapshot = loco_get_yeet_snapshot_from_user(app, "Delete snapshot:", false);
+    if (snapshot != 0)
+    {
+        loco_remove_yeet_snapshot(snapshot);
+        loco_yeet_snapshot_file_dirty = true;
+    }
+}
+
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_save_yeet_snapshot_1)
 CUSTOM_DOC("Save yeets snapshot to slot 1.")
 {
-    loco_save_yeet_snapshot_to_slot(app, 0);
+    loco_save_yeet_snapshot(app, string_u8_litexpr("1"));
 }
 
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_save_yeet_snapshot_2)
 CUSTOM_DOC("Save yeets snapshot to slot 2.")
 {
-    loco_save_yeet_snapshot_to_slot(app, 1);
+    loco_save_yeet_snapshot(app, string_u8_litexpr("2"));
 }
 
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_save_yeet_snapshot_3)
 CUSTOM_DOC("Save yeets snapshot to slot 3.")
 {
-    loco_save_yeet_snapshot_to_slot(app, 2);
+    loco_save_yeet_snapshot(app, string_u8_litexpr("3"));
 }
 
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_load_yeet_snapshot_1)
 CUSTOM_DOC("Load yeets snapshot from slot 1.")
 {
-    loco_load_yeet_snapshot_from_slot(app, 0);
+    loco_load_yeet_snapshot_by_name(app, string_u8_litexpr("1"));
 }
 
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_load_yeet_snapshot_2)
 CUSTOM_DOC("Load yeets snapshot from slot 2.")
 {
-    loco_load_yeet_snapshot_from_slot(app, 1);
+    loco_load_yeet_snapshot_by_name(app, string_u8_litexpr("2"));
 }
 
 //~ @command @snapshot
 CUSTOM_COMMAND_SIG(loco_load_yeet_snapshot_3)
 CUSTOM_DOC("Load yeets snapshot from slot 3.")
 {
-    loco_load_yeet_snapshot_from_slot(app, 2);
+    loco_load_yeet_snapshot_by_name(app, string_u8_litexpr("3"));
+}
+
+//--SNAPSHOT-DIFF
+
+//~ @snapshot @diff
+// Every pair of a snapshot in sheet order, dormant ones included. Tables are stored in
+// sheet order, see loco_overwrite_yeets.
+static Loco_Yeets
+loco_get_snapshot_ordered_pairs(Application_Links *app, Arena *arena, Loco_Yeet_Snapshot *snapshot)
+{
+    return loco_pair_table_flatten(arena, snapshot->table);
+}
+
+//~ @snapshot @diff @hash
+// Same file and same text, for finding a block that was yeeted again under another uid.
+static u64
+loco_pair_content_key(Loco_Marker_Pair pair)
+{
+    return loco_hash_bytes(pair.fingerprint.content_hash, (u8*)&pair.file_id, sizeof(pair.file_id));
+}
+
+//~ @snapshot @diff
+// Matches the pairs of two snapshots by uid, or failing that by file and text, so the
+// same block yeeted twice still counts once. a_match and b_match get the index of the
+// matched pair or -1. Linear in the number of pairs, with a hash table per key.
+static void
+loco_match_snapshot_pairs(Loco_Yeets *a, Loco_Yeets *b, i32 *a_match, i32 *b_match)
+{
+    Base_Allocator *allocator = get_base_allocator_system();
+    Table_u64_u64 a_from_uid = make_table_u64_u64(allocator, a->pairs_count*2 + 8);
+    Table_u64_u64 a_from_content = make_table_u64_u64(allocator, a->pairs_count*2 + 8);
+    for (i32 i = 0; i < a->pairs_count; i++)
+    {
+        u64 existing = 0;
+        u64 content_key = loco_pair_content_key(a->pairs[i]);
+        a_match[i] = -1;
+        table_insert(&a_from_uid, a->pairs[i].uid, (u64)i);
+        if (!table_read(&a_from_content, content_key, &existing)) table_insert(&a_from_content, content_key, (u64)i);
+    }
+    for (i32 j = 0; j < b->pairs_count; j++)
+    {
+        b_match[j] = -1;
+        u64 i = 0;
+        if (!(table_read(&a_from_uid, b->pairs[j].uid, &i) && a_match[i] < 0) &&
+            !(table_read(&a_from_content, loco_pair_content_key(b->pairs[j]), &i) && a_match[i] < 0)) continue;
+        a_match[i] = j;
+        b_match[j] = (i32)i;
+    }
+    table_free(&a_from_uid);
+    table_free(&a_from_content);
+}
+
+//~ @snapshot @diff
+// Where a pair's block is, "path:first-last line" or the last known bytes if it's closed.
+static String_Const_u8
+loco_push_pair_location(Application_Links *app, Arena *arena, Loco_Marker_Pair pair)
+{
+    String_Const_u8 path = loco_path_from_id(pair.file_id);
+    if (!HasFlag(pair.flags, Loco_Pair_Flag_Dormant) && buffer_exists(app, pair.buffer))
+    {
+        if (path.size == 0) path = push_buffer_unique_name(app, arena, pair.buffer);
+        Range_i64 range = loco_get_marker_range(app, pair.buffer, pair.start_marker_idx, pair.end_marker_idx);
+        i64 start_line = get_line_number_from_pos(app, pair.buffer, range.min);
+        i64 end_line = get_line_number_from_pos(app, pair.buffer, range.max);
+        return push_u8_stringf(arena, "%.*s:%lld-%lld", string_expand(path), start_line, end_line);
+    }
+    return push_u8_stringf(arena, "%.*s (closed) bytes %lld-%lld", string_expand(path), pair.dormant_range.min, pair.dormant_range.max);
+}
+
+//~ @snapshot @diff @buffer
+static void
+loco_show_yeet_diff(Application_Links *app, String_Const_u8 text)
+{
+    String_Const_u8 diff_name = string_u8_litexpr("*yeet diff*");
+    Buffer_ID diff_buffer = get_buffer_by_name(app, diff_name, Access_Always);
+    if (!buffer_exists(app, diff_buffer))
+    {
+        diff_buffer = create_buffer(app, diff_name, BufferCreate_AlwaysNew);
+        buffer_set_setting(app, diff_buffer, BufferSetting_Unimportant, true);
+    }
+    buffer_replace_range(app, diff_buffer, Ii64(0, buffer_get_size(app, diff_buffer)), text);
+    
+    View_ID view = get_next_view_after_active(app, Access_Always);
+    view_set_buffer(app, view, diff_buffer, 0);
+    view_set_cursor_and_preferred_x(app, view, seek_pos(0));
+}
+
+//~ @snapshot @diff
+// Writes the blocks of to that from doesn't have (+), the ones from has that to doesn't (-)
+// and the ones both have but in another order (~) to the *yeet diff* buffer. Moved blocks
+// are the ones left out of the longest run that kept its order, like a snapshot switch.
+static void
+loco_diff_yeet_snapshots(Application_Links *app, Loco_Yeet_Snapshot *from_snapshot, Loco_Yeet_Snapshot *to_snapshot)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets from = loco_get_snapshot_ordered_pairs(app, scratch, from_snapshot);
+    Loco_Yeets to = loco_get_snapshot_ordered_pairs(app, scratch, to_snapshot);
+    i32 *from_match = push_array(scratch, i32, from.pairs_count);
+    i32 *to_match = push_array(scratch, i32, to.pairs_count);
+    loco_match_snapshot_pairs(&from, &to, from_match, to_match);
+    i32 in_order_count = 0;
+    b8 *in_order = loco_mark_longest_increasing_run(scratch, to_match, to.pairs_count, &in_order_count);
+    
+    List_String_Const_u8 lines = {};
+    i32 added_count = 0;
+    i32 removed_count = 0;
+    i32 moved_count = 0;
+    for (i32 i = 0; i < from.pairs_count; i++)
+    {
+        if (from_match[i] >= 0) continue;
+        string_list_pushf(scratch, &lines, "- %.*s\n", string_expand(loco_push_pair_location(app, scratch, from.pairs[i])));
+        removed_count += 1;
+    }
+    for (i32 j = 0; j < to.pairs_count; j++)
+    {
+        if (to_match[j] < 0)
+        {
+            string_list_pushf(scratch, &lines, "+ %.*s\n", string_expand(loco_push_pair_location(app, scratch, to.pairs[j])));
+            added_count += 1;
+        }
+        else if (!in_order[j])
+        {
+            string_list_pushf(scratch, &lines, "~ %.*s\n", string_expand(loco_push_pair_location(app, scratch, to.pairs[j])));
+            moved_count += 1;
+        }
+    }
+    
+    List_String_Const_u8 text = {};
+    string_list_pushf(scratch, &text, "yeet diff: %.*s -> %.*s\n%d added, %d removed, %d moved, %d unchanged\n\n",
+                      string_expand(from_snapshot->name), string_expand(to_snapshot->name),
+                      added_count, removed_count, moved_count, in_order_count);
+    string_list_push(scratch, &text, string_list_flatten(scratch, lines));
+    loco_show_yeet_diff(app, string_list_flatten(scratch, text));
+}
+
+//~ @snapshot @diff
+// Appends the blocks of from that into doesn't have yet to the end of into, leaving the
+// pairs into already has, and so the chunks it shares, as they are.
+// Returns the number of blocks added.
+static i32
+loco_merge_yeet_snapshots(Application_Links *app, Loco_Yeet_Snapshot *from_snapshot, Loco_Yeet_Snapshot *into_snapshot)
+{
+    Scratch_Block scratch(app);
+    Loco_Yeets from = loco_get_snapshot_ordered_pairs(app, scratch, from_snapshot);
+    Loco_Yeets into = loco_pair_table_flatten(scratch, into_snapshot->table);
+    i32 *into_match = push_array(scratch, i32, into.pairs_count);
+    i32 *from_match = push_array(scratch, i32, from.pairs_count);
+    loco_match_snapshot_pairs(&into, &from, into_match, from_match);
+    
+    Loco_Yeets merged = {};
+    merged.pairs = push_array(scratch, Loco_Marker_Pair, into.pairs_count + from.pairs_count);
+    block_copy(merged.pairs, into.pairs, sizeof(Loco_Marker_Pair)*into.pairs_count);
+    merged.pairs_count = into.pairs_count;
+    i32 next_yeet_marker_idx = 0;
+    for (i32 i = 0; i < into.pairs_count; i++)
+    {
+        next_yeet_marker_idx = Max(next_yeet_marker_idx, into.pairs[i].yeet_end_marker_idx + 1);
+    }
+    for (i32 j = 0; j < from.pairs_count; j++)
+    {
+        if (from_match[j] >= 0) continue;
+        Loco_Marker_Pair &pair = merged.pairs[merged.pairs_count++];
+        pair = from.pairs[j];
+        pair.yeet_start_marker_idx = next_yeet_marker_idx;
+        pair.yeet_end_marker_idx = next_yeet_marker_idx + 1;
+        next_yeet_marker_idx += 2;
+    }
+    
+    i32 added_count = merged.pairs_count - into.pairs_count;
+    if (added_count > 0)
+    {
+        Loco_Pair_Table *old_table = into_snapshot->table;
+        into_snapshot->table = loco_pair_table_make(merged.pairs, merged.pairs_count, old_table);
+        loco_pair_table_release(old_table);
+        loco_yeet_snapshot_file_dirty = true;
+    }
+    return added_count;
+}
+
+//~ @command @snapshot @diff
+CUSTOM_COMMAND_SIG(loco_yeet_diff_snapshots)
+CUSTOM_DOC("Lists the yeet blocks added, removed and moved between two snapshots, or a snapshot and the yeet sheet.")
+{
+    Loco_Yeet_Snapshot *from_snapshot = loco_get_yeet_snapshot_from_user(app, "Diff from:", true);
+    if (from_snapshot == 0) return;
+    Loco_Yeet_Snapshot *to_snapshot = loco_get_yeet_snapshot_from_user(app, "Diff to:", true);
+    if (to_snapshot == 0) return;
+    loco_diff_yeet_snapshots(app, from_snapshot, to_snapshot);
+}
+
+//~ @command @snapshot @diff
+CUSTOM_COMMAND_SIG(loco_yeet_merge_snapshots)
+CUSTOM_DOC("Adds the yeet blocks of one snapshot, or the yeet sheet, that another snapshot doesn't have yet.")
+{
+    Loco_Yeet_Snapshot *from_snapshot = loco_get_yeet_snapshot_from_user(app, "Merge from:", true);
+    if (from_snapshot == 0) return;
+    Loco_Yeet_Snapshot *into_snapshot = loco_get_yeet_snapshot_from_user(app, "Merge into:", false);
+    if (into_snapshot == 0 || into_snapshot == from_snapshot) return;
+    
+    i32 added_count = loco_merge_yeet_snapshots(app, from_snapshot, into_snapshot);
+    Scratch_Block scratch(app);
+    String_Const_u8 message = push_u8_stringf(scratch, "yeet: merged %d blocks from %.*s into %.*s.\n", added_count,
+                                              string_expand(from_snapshot->name), string_expand(into_snapshot->name));
+    print_message(app, message);
+}
+
+//--HISTORY-COMMANDS
+
+//~ @history
+// Moves the sheet one version back or forward. The version is loaded like a snapshot, so
+// only the blocks that differ from the sheet are removed or inserted.
+static bool
+loco_yeet_history_step(Application_Links *app, bool is_redo)
+{
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Loco_Yeet_History *history = &loco_get_yeet_sheet(app, yeet_buffer)->history;
+    Loco_Pair_Table **from = is_redo ? history->redo : history->undo;
+    i32 *from_count = is_redo ? &history->redo_count : &history->undo_count;
+    Loco_Pair_Table **to = is_redo ? history->undo : history->redo;
+    i32 *to_count = is_redo ? &history->undo_count : &history->redo_count;
+    if (*from_count == 0) return false;
+    
+    if (*to_count == history->cap) loco_yeet_history_drop_oldest(to, to_count);
+    to[(*to_count)++] = loco_pair_table_retain(*loco_get_yeet_pair_table(app, yeet_buffer));
+    
+    Loco_Pair_Table *version = from[--(*from_count)];
+    Loco_Yeet_Snapshot version_snapshot = {};
+    version_snapshot.name = loco_active_yeet_snapshot;
+    version_snapshot.table = version;
+    loco_load_yeet_snapshot(app, &version_snapshot);
+    loco_pair_table_release(version);
+    
+    Scratch_Block scratch(app);
+    String_Const_u8 message = push_u8_stringf(scratch, "yeet: %s, %d undo and %d redo steps left, history holds %llu KB.\n",
+                                              is_redo ? "redo" : "undo", history->undo_count, history->redo_count,
+                                              loco_yeet_history_memory(app, history)/KB(1));
+    print_message(app, message);
+    return true;
+}
+
+//~ @command @history
+CUSTOM_COMMAND_SIG(loco_yeet_undo)
+CUSTOM_DOC("Undoes the last yeet, remove, clear or snapshot load.")
+{
+    loco_yeet_history_step(app, false);
+}
+
+//~ @command @history
+CUSTOM_COMMAND_SIG(loco_yeet_redo)
+CUSTOM_DOC("Redoes the last undone yeet sheet change.")
+{
+    loco_yeet_history_step(app, true);
+}
+
+//--SHEET-COMMANDS
+
+//~ @sheet
+// Makes the sheet current and shows it, in the active view if that already shows a sheet,
+// otherwise in the next view.
+static void
+loco_show_yeet_sheet(Application_Links *app, Buffer_ID sheet)
+{
+    loco_set_current_yeet_sheet(app, sheet);
+    View_ID view = get_active_view(app, Access_Always);
+    if (!loco_is_yeet_sheet(app, view_get_buffer(app, view, Access_Always)))
+    {
+        view = get_next_view_after_active(app, Access_Always);
+    }
+    view_set_buffer(app, view, sheet, 0);
+}
+
+//~ @command @sheet
+CUSTOM_COMMAND_SIG(loco_yeet_new_sheet)
+CUSTOM_DOC("Queries for a name and makes a yeet sheet with that name the current one.")
+{
+    u8 space[256];
+    String_Const_u8 name = get_query_string(app, "Sheet name: ", space, sizeof(space));
+    if (name.size == 0) return;
+    Scratch_Block scratch(app);
+    String_Const_u8 sheet_name = push_u8_stringf(scratch, "*yeet:%.*s*", string_expand(name));
+    loco_show_yeet_sheet(app, loco_make_yeet_sheet(app, sheet_name));
+}
+
+//~ @command @sheet @portal
+CUSTOM_COMMAND_SIG(loco_yeet_new_portal_sheet)
+CUSTOM_DOC("Queries for a name and makes a portal yeet sheet with that name the current one, its blocks are edited in place through their source.")
+{
+    u8 space[256];
+    String_Const_u8 name = get_query_string(app, "Portal sheet name: ", space, sizeof(space));
+    if (name.size == 0) return;
+    Scratch_Block scratch(app);
+    String_Const_u8 sheet_name = push_u8_stringf(scratch, "*yeet:%.*s*", string_expand(name));
+    Buffer_ID sheet = loco_make_yeet_sheet(app, sheet_name);
+    
+    // Blocks that already hold a copy of their text can't become stand-ins.
+    Loco_Pair_Table *table = *loco_get_yeet_pair_table(app, sheet);
+    if (table == 0 || table->pairs_count == 0)
+    {
+        loco_get_yeet_sheet(app, sheet)->is_portal = true;
+    }
+    else if (!loco_get_yeet_sheet(app, sheet)->is_portal)
+    {
+        print_message(app, string_u8_litexpr("yeet: that sheet already has copied blocks, it stays a normal sheet.\n"));
+    }
+    loco_show_yeet_sheet(app, sheet);
+}
+
+//~ @command @sheet
+CUSTOM_COMMAND_SIG(loco_yeet_toggle_read_only_sheet)
+CUSTOM_DOC("Toggles the current yeet sheet between a normal sheet and a read-only mirror of its sources.")
+{
+    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    Loco_Yeet_Sheet *sheet = loco_get_yeet_sheet(app, yeet_buffer);
+    if (sheet->is_portal)
+    {
+        print_message(app, string_u8_litexpr("yeet: a portal sheet has no copies to mirror.\n"));
+        return;
+    }
+    // Stale blocks left behind by a mirror are lazy, a normal sheet fills them in when seen.
+    sheet->is_read_only = !sheet->is_read_only;
+    sheet->dirty_sources.count = 0;
+    buffer_set_setting(app, yeet_buffer, BufferSetting_ReadOnly, sheet->is_read_only);
+    Scratch_Block scratch(app);
+    String_Const_u8 unique_name = push_buffer_unique_name(app, scratch, yeet_buffer);
+    print_message(app, push_u8_stringf(scratch, "yeet: %.*s is %s.\n", string_expand(unique_name), sheet->is_read_only ? "a read-only mirror" : "editable"));
+}
+
+//~ @command @verify
+CUSTOM_COMMAND_SIG(loco_yeet_verify)
+CUSTOM_DOC("Checks every yeet block against its source by hash and marks the ones that diverged.")
+{
+    loco_flush_pending_sync(app);
+    i32 diverged_count = loco_verify_yeet_sheets(app, loco_yeet_verify_repair);
+    Scratch_Block scratch(app);
+    String_Const_u8 message = push_u8_stringf(scratch, "yeet: %d blocks diverged from their source%s.\n", diverged_count,
+                                              (loco_yeet_verify_repair && diverged_count > 0) ? ", copying them again" : "");
+    print_message(app, message);
+}
+
+//~ @command @sheet
+CUSTOM_COMMAND_SIG(loco_yeet_switch_sheet)
+CUSTOM_DOC("Lists the yeet sheets and makes the chosen one the current one.")
+{
+    loco_get_yeet_buffer(app);
+    Scratch_Block scratch(app);
+    Lister_Block lister(app, scratch);
+    lister_set_query(lister, "Switch sheet:");
+    lister_set_default_handlers(lister);
+    for (i32 s = 0; s < loco_yeet_sheets.buffers.count; s++)
+    {
+        Buffer_ID sheet = loco_yeet_sheets.buffers.ids[s];
+        Loco_Pair_Table *table = *loco_get_yeet_pair_table(app, sheet);
+        i32 pairs_count = (table != 0) ? table->pairs_count : 0;
+        bool is_current = (sheet == loco_yeet_sheets.current);
+        String_Const_u8 status = push_u8_stringf(scratch, "%d yeets%s", pairs_count, is_current ? " (current)" : "");
+        lister_add_item(lister, push_buffer_unique_name(app, scratch, sheet), status, IntAsPtr(sheet), 0);
+    }
+    Lister_Result l_result = run_lister(app, lister);
+    if (l_result.canceled) return;
+    loco_show_yeet_sheet(app, (Buffer_ID)PtrAsInt(l_result.user_data));
 }
 
 //--CATEGORIES
@@ -918,22 +6005,107 @@ enum Loco_Yeet_Tags_Parse_State
 };
 
 // @yeettags @yeettype
-struct Loco_Yeet_Tag_Range
+// Matches "@word" tags one character at a time, so a comment never has
+// to be copied out of the buffer to be searched.
+struct Loco_Yeet_Tag_Matcher
 {
-    Range_i64 range;
+    String_Const_u8 tag_name;
+    Loco_Yeet_Tags_Parse_State parse_state;
+    u64 match_count;
+    bool is_matching;
 };
 
+//~ @yeettags
+// Feed the next character of a comment, pass 0 at the end of the comment.
+// Returns true when a whole tag word equal to tag_name has just ended.
+static bool
+loco_yeet_tag_matcher_feed(Loco_Yeet_Tag_Matcher *matcher, u8 c)
+{
+    bool is_lower_alpha = (c >= 'a' && c <= 'z');
+    bool is_upper_alpha = (c >= 'A' && c <= 'Z');
+    bool is_numeric = (c >= '0' && c <= '9');
+    bool is_alphanumeric = (is_lower_alpha || is_upper_alpha || is_numeric);
+    
+    if (matcher->parse_state == Loco_Tag_PState_Reading_Word)
+    {
+        if (is_alphanumeric)
+        {
+            String_Const_u8 tag_name = matcher->tag_name;
+            if (matcher->is_matching && 
+                matcher->match_count < tag_name.size &&
+                tag_name.str[matcher->match_count] == c)
+            {
+                matcher->match_count += 1;
+            }
+            else
+            {
+                matcher->is_matching = false;
+            }
+            return false;
+        }
+        
+        matcher->parse_state = Loco_Tag_PState_End_Of_Word;
+    }
+    
+    bool found_tag = false;
+    if (matcher->parse_state == Loco_Tag_PState_End_Of_Word)
+    {
+        found_tag = (matcher->is_matching && matcher->match_count == matcher->tag_name.size);
+        // Fall through so the character that ended the word can start
+        // the next tag, e.g. "@net@render".
+        matcher->parse_state = Loco_Tag_PState_Looking_For_Tag;
+    }
+    
+    if (c == '@')
+    {
+        matcher->parse_state = Loco_Tag_PState_Reading_Word;
+        matcher->match_count = 0;
+        matcher->is_matching = true;
+    }
+    
+    return found_tag;
+}
+
+//~ @yeettags
+// Streams a line, block or doc comment through a small stack window and
+// returns true if any of its tags match. No scratch memory is used.
+static bool
+loco_yeet_comment_has_tag(Application_Links *app, Buffer_ID buffer, Token *tok, String_Const_u8 tag_name)
+{
+    Loco_Yeet_Tag_Matcher matcher = {};
+    matcher.tag_name = tag_name;
+    matcher.parse_state = Loco_Tag_PState_Looking_For_Tag;
+    
+    u8 window[256];
+    i64 comment_end = tok->pos + tok->size;
+    for (i64 chunk_start = tok->pos; chunk_start < comment_end; chunk_start += sizeof(window))
+    {
+        i64 chunk_end = chunk_start + sizeof(window);
+        if (chunk_end > comment_end) chunk_end = comment_end;
+        if (!buffer_read_range(app, buffer, Ii64(chunk_start, chunk_end), window)) return false;
+        
+        i64 chunk_size = chunk_end - chunk_start;
+        for (i64 i = 0; i < chunk_size; i++)
+        {
+            if (loco_yeet_tag_matcher_feed(&matcher, window[i])) return true;
+        }
+    }
+    
+    return loco_yeet_tag_matcher_feed(&matcher, 0);
+}
+
 //~ @yeettags
 static void
 loco_yeet_all_scopes_with_tag(Application_Links *app, Buffer_ID buffer, String_Const_u8 tag_name)
 {
     Token_Array token_arr = get_token_array_from_buffer(app, buffer);
-    if (token_arr.tokens == 0) return;
+    if (token_arr.tokens == 0 || tag_name.size == 0) return;
     
     Scratch_Block scratch(app);
     Token_Iterator_Array it = token_iterator_index(buffer, &token_arr, 0);
-    Loco_Yeet_Tag_Range tag_ranges[1024];
-    u64 tag_ranges_count = 0;
+    // Tagged scopes are collected on the scratch arena, so memory grows with the number of hits.
+    Loco_Range_List tag_ranges = {};
+    Range_i64 tag_range = {};
     Loco_Yeet_Tags_Parse_State root_parse_state = Loco_Tag_PState_Looking_For_Comment;
     u64 scope_enter_count = 0;
     
@@ -947,57 +6119,13 @@ loco_yeet_all_scopes_with_tag(Application_Links *app, Buffer_ID buffer, String_C
             continue;
         }
         
-        if (tok->sub_kind == TokenCppKind_LineComment && root_parse_state == Loco_Tag_PState_Looking_For_Comment)
+        // Covers "//", "/* */" and "/** */" comments alike.
+        if (tok->kind == TokenBaseKind_Comment && root_parse_state == Loco_Tag_PState_Looking_For_Comment)
         {
-            String_Const_u8 tok_str = push_buffer_range(app, scratch, buffer, Ii64(tok));
-            Loco_Yeet_Tags_Parse_State parse_state = Loco_Tag_PState_Looking_For_Tag;
-            i64 tag_start = 0;
-            i64 tag_end = 0;
-            bool found_tag = false;
-            
-            for (u64 i = 0; i <= tok_str.size; i++)
-            {
-                u8 c = (i < tok_str.size) ? tok_str.str[i] : 0;
-                switch(parse_state)
-                {
-                    case Loco_Tag_PState_Looking_For_Tag: {
-                        if (c == '@')
-                        {
-                            parse_state = Loco_Tag_PState_Reading_Word;
-                            tag_start = i+1;
-                        }
-                        break;
-                    }
-                    case Loco_Tag_PState_Reading_Word: {
-                        bool is_lower_alpha = (c >= 'a' && c <= 'z');
-                        bool is_upper_alpha = (c >= 'A' && c <= 'Z');
-                        bool is_numeric = (c >= '0' && c <= '9');
-                        bool is_alphanumeric = (is_lower_alpha || is_upper_alpha || is_numeric);
-                        if (!is_alphanumeric)
-                        {
-                            parse_state = Loco_Tag_PState_End_Of_Word;
-                            tag_end = i;
-                        }
-                        break;
-                    }
-                }
-                
-                if (parse_state == Loco_Tag_PState_End_Of_Word)
-                {
-                    parse_state = Loco_Tag_PState_Looking_For_Tag;
-                    String_Const_u8 sub = string_substring(tok_str, Ii64(tag_start, tag_end));
-                    if (string_match(sub, tag_name))
-                    {
-                        found_tag = true;
-                        break;
-                    }
-                }
-            }
-            
-            if (found_tag)
+            if (loco_yeet_comment_has_tag(app, buffer, tok, tag_name))
             {
                 root_parse_state = Loco_Tag_PState_Looking_For_Scope_Start;
-                tag_ranges[tag_ranges_count].range.min = tok->pos;
+                tag_range.min = tok->pos;
             }
         }
         
@@ -1020,38 +6148,42 @@ loco_yeet_all_scopes_with_tag(Application_Links *app, Buffer_ID buffer, String_C
             if (scope_enter_count == 0)
             {
                 root_parse_state = Loco_Tag_PState_Looking_For_Comment;
-                tag_ranges[tag_ranges_count].range.max = tok->pos+1;
-                tag_ranges_count += 1;
+                tag_range.max = tok->pos+1;
+                loco_range_list_push(scratch, &tag_ranges, tag_range);
             }
         }
         
         if (!token_it_inc_non_whitespace(&it)) break;
     }
     
-    for (u64 i = 0; i < tag_ranges_count; i++)
-    {
-        loco_yeet_buffer_range(app, buffer, tag_ranges[i].range);
-    }
+    // Yeet every hit with a single insertion into the yeet buffer.
+    loco_yeet_buffer_ranges(app, buffer, &tag_ranges);
 }
 
 //--TAG-COMMANDS
 
 // @command @yeettags
 CUSTOM_COMMAND_SIG(loco_yeet_tag)
-CUSTOM_DOC("Find all locations of a comment tag (//@tag) in all buffers and yeet the scope they precede.")
+CUSTOM_DOC("Find all locations of a comment tag (//@tag or /* @tag */) in all buffers and yeet the scope they precede.")
 {
     Scratch_Block scratch(app);
     u8 *space = push_array(scratch, u8, KB(1));
     String_Const_u8 tag_name = get_query_string(app, "Yeet Tag: ", space, KB(1));
-    Buffer_ID yeet_buffer = loco_get_yeet_buffer(app);
+    // Accept "@tag" as well as "tag".
+    if (tag_name.size > 0 && tag_name.str[0] == '@')
+    {
+        tag_name = string_skip(tag_name, 1);
+    }
+    loco_yeet_history_begin(app);
     for (Buffer_ID buffer = get_buffer_next(app, 0, Access_ReadWriteVisible);
          buffer != 0;
          buffer = get_buffer_next(app, buffer, Access_ReadWriteVisible))
     {
-        if (buffer == yeet_buffer) continue;
+        if (loco_is_yeet_sheet(app, buffer)) continue;
         
         loco_yeet_all_scopes_with_tag(app, buffer, tag_name);
     }
+    loco_yeet_history_end(app);
 }
 
 
@@ -0,0 +1,480 @@
+// YEET SHEET pair tables and file formats.
+// The copy-on-write pair tables and the layouts of the snapshot file and the session journal.
+// This part only uses the 4coder base layer (arenas, the base allocator and the block_
+// functions), so tests/loco_yeets_data_check.cpp can build it without the rest of 4coder.
+// 4coder_loco_yeets.cpp includes it, there is no need to include it yourself.
+
+//--DATA-TYPES
+
+// @yeettype @anchor
+// Enough about a block and its surroundings to find it again after its markers were
+// lost, e.g. when the file was changed on disk and reloaded.
+struct Loco_Fingerprint
+{
+    u64 content_hash;
+    // Hash of the first loco_yeet_anchor_head_size bytes, what the rolling search looks for.
+    u64 head_hash;
+    // A few lines before and after the block.
+    u64 before_hash;
+    u64 after_hash;
+    // The whole lines the block starts and ends on, for when the block itself changed.
+    u64 first_line_hash;
+    u64 last_line_hash;
+    i64 content_size;
+    i32 line_count;
+    i32 start_column;
+    i32 end_column;
+};
+
+// @yeettype
+struct Loco_Marker_Pair
+{
+    i32 start_marker_idx;
+    i32 end_marker_idx;
+    i32 yeet_start_marker_idx;
+    i32 yeet_end_marker_idx;
+    Buffer_ID buffer;
+    // Interned file path of the source buffer, 0 for buffers without a file.
+    u32 file_id;
+    u32 flags;
+    // Unique per yeet and kept by every copy of the pair, so the copies in
+    // different snapshots can share one set of markers.
+    u64 uid;
+    // Last known source range, only used while dormant.
+    Range_i64 dormant_range;
+    Loco_Fingerprint fingerprint;
+    // Content hashes of the source range and the yeet block from the last verify that
+    // hashed them, valid with Loco_Pair_Flag_Hashed.
+    u64 source_hash;
+    u64 yeet_hash;
+};
+
+// @yeettype
+// A flat copy of a pair table, pushed onto an arena when the pairs are needed.
+struct Loco_Yeets
+{
+    Loco_Marker_Pair *pairs;
+    i32 pairs_count;
+};
+
+// @yeettype @snapshot
+// Fixed size run of pairs. Chunks are reference counted and shared between the
+// live pair table and every snapshot that holds the same pairs. A chunk never changes
+// after loco_pair_table_make, a change to its pairs goes into a new table.
+struct Loco_Pair_Chunk
+{
+    i32 ref_count;
+    i32 count;
+    Loco_Marker_Pair pairs[64];
+};
+
+// @yeettype @snapshot
+// Copy-on-write pair table. The yeet buffer's managed scope holds a pointer to the
+// live table, saving a snapshot only takes another reference to it. Rebuilding the
+// table after an edit reuses every chunk whose pairs didn't change.
+// Tables and chunks are allocated from the system allocator so they outlive any arena.
+struct Loco_Pair_Table
+{
+    i32 ref_count;
+    i32 pairs_count;
+    i32 chunks_count;
+    Loco_Pair_Chunk **chunks;
+};
+
+// @yeettype @persist
+// On disk the snapshot file is a header followed by the path table, the snapshot table,
+// the pair records and the string bytes (paths, then snapshot names). Every section is 8 byte aligned and
+// fixed size, so after one read the records are used in place without any parsing.
+struct Loco_Snapshot_File_Header
+{
+    u32 magic;
+    u32 version;
+    u32 path_count;
+    u32 snapshot_count;
+    u32 pair_count;
+    u32 string_bytes;
+};
+
+// @yeettype @persist
+struct Loco_Snapshot_File_Path
+{
+    u32 offset;
+    u32 size;
+};
+
+// @yeettype @persist
+struct Loco_Snapshot_File_Snapshot
+{
+    u32 first_pair;
+    u32 pair_count;
+    u32 name_offset;
+    u32 name_size;
+};
+
+// @yeettype @persist
+struct Loco_Snapshot_File_Pair
+{
+    u64 uid;
+    Loco_Fingerprint fingerprint;
+    i64 start;
+    i64 end;
+    u32 path_index;
+    // The pair's Dormant and Lazy flags when it was written. A lazy pair loads as a placeholder.
+    u32 flags;
+};
+
+// @yeettype @persist
+// The tables of a snapshot file. Packing lays them out in one image, unpacking points
+// them into an image that was read back.
+struct Loco_Snapshot_File_View
+{
+    Loco_Snapshot_File_Header header;
+    Loco_Snapshot_File_Path *paths;
+    Loco_Snapshot_File_Snapshot *snapshots;
+    Loco_Snapshot_File_Pair *pairs;
+    u8 *strings;
+};
+
+global const u32 loco_yeet_snapshot_file_magic = 0x5359454C; // "LEYS"
+global const u32 loco_yeet_snapshot_file_version = 3;
+
+// @yeettype @session
+// The session file is a journal: a header and then records, each followed by its payload
+// padded to 8 bytes. Replaying the records in order gives the live pair table.
+struct Loco_Session_File_Header
+{
+    u32 magic;
+    u32 version;
+};
+
+global const u32 loco_yeet_session_file_magic = 0x5353454C; // "LESS"
+global const u32 loco_yeet_session_file_version = 1;
+
+// @yeettype @session
+enum Loco_Session_Record_Kind
+{
+    // index is the new pair count, there is no payload.
+    Loco_Session_Record_Table = 1,
+    // index is the chunk, count its pairs, the payload is count Loco_Session_Pair.
+    Loco_Session_Record_Chunk = 2,
+    // index is the path id the pairs use, the payload is count bytes of path.
+    Loco_Session_Record_Path = 3,
+    // The payload is count bytes of the active snapshot's name.
+    Loco_Session_Record_Active = 4,
+};
+
+// @yeettype @session
+struct Loco_Session_Record
+{
+    u32 kind;
+    u32 index;
+    u32 count;
+    u32 size;
+};
+
+// @yeettype @session
+// A snapshot pair record where path_index is a path id of the journal, plus the block's
+// place in the sheet, counted in blocks.
+struct Loco_Session_Pair
+{
+    Loco_Snapshot_File_Pair record;
+    i64 sheet_key;
+};
+
+// @yeettype @session
+struct Loco_Session_Path
+{
+    Loco_Session_Path *next;
+    u32 path_id;
+    String_Const_u8 path;
+};
+
+// @yeettype @session
+// What replaying a journal gives: the pairs of the table, the path records in the order
+// they were written (a later one for the same id wins) and the active snapshot's name.
+// The strings point into the journal's image.
+struct Loco_Session_Replay
+{
+    Loco_Session_Pair *pairs;
+    i32 pairs_count;
+    Loco_Session_Path *first_path;
+    Loco_Session_Path *last_path;
+    String_Const_u8 active;
+};
+
+//--PAIR-TABLE
+
+//~ @snapshot @pairtable
+static Loco_Pair_Table*
+loco_pair_table_retain(Loco_Pair_Table *table)
+{
+    if (table != 0) table->ref_count += 1;
+    return table;
+}
+
+//~ @snapshot @pairtable
+// Drops a reference, freeing the table and any chunks nobody else shares.
+static void
+loco_pair_table_release(Loco_Pair_Table *table)
+{
+    if (table == 0) return;
+    table->ref_count -= 1;
+    if (table->ref_count > 0) return;
+    
+    Base_Allocator *allocator = get_base_allocator_system();
+    for (i32 c = 0; c < table->chunks_count; c++)
+    {
+        Loco_Pair_Chunk *chunk = table->chunks[c];
+        chunk->ref_count -= 1;
+        if (chunk->ref_count == 0) base_free(allocator, chunk);
+    }
+    base_free(allocator, table->chunks);
+    base_free(allocator, table);
+}
+
+//~ @snapshot @pairtable
+// Builds a table holding the given pairs. Chunks of like_table that hold exactly the same
+// pairs are shared instead of copied, so a small change to a big table only costs the
+// chunks it touched. Returns 0 for an empty table.
+static Loco_Pair_Table*
+loco_pair_table_make(Loco_Marker_Pair *pairs, i32 pairs_count, Loco_Pair_Table *like_table)
+{
+    if (pairs_count <= 0) return 0;
+    
+    Base_Allocator *allocator = get_base_allocator_system();
+    i32 chunk_cap = ArrayCount(((Loco_Pair_Chunk*)0)->pairs);
+    Loco_Pair_Table *table = (Loco_Pair_Table*)base_allocate(allocator, sizeof(Loco_Pair_Table)).data;
+    table->ref_count = 1;
+    table->pairs_count = pairs_count;
+    table->chunks_count = (pairs_count + chunk_cap - 1)/chunk_cap;
+    table->chunks = (Loco_Pair_Chunk**)base_allocate(allocator, sizeof(Loco_Pair_Chunk*)*table->chunks_count).data;
+    
+    for (i32 c = 0; c < table->chunks_count; c++)
+    {
+        Loco_Marker_Pair *chunk_pairs = pairs + c*chunk_cap;
+        i32 count = Min(chunk_cap, pairs_count - c*chunk_cap);
+        u64 chunk_pairs_size = sizeof(Loco_Marker_Pair)*count;
+        
+        Loco_Pair_Chunk *chunk = 0;
+        if (like_table != 0 && c < like_table->chunks_count)
+        {
+            Loco_Pair_Chunk *like_chunk = like_table->chunks[c];
+            if (like_chunk->count == count && block_match(like_chunk->pairs, chunk_pairs, chunk_pairs_size))
+            {
+                chunk = like_chunk;
+                chunk->ref_count += 1;
+            }
+        }
+        if (chunk == 0)
+        {
+            chunk = (Loco_Pair_Chunk*)base_allocate(allocator, sizeof(Loco_Pair_Chunk)).data;
+            chunk->ref_count = 1;
+            chunk->count = count;
+            block_copy(chunk->pairs, chunk_pairs, chunk_pairs_size);
+        }
+        table->chunks[c] = chunk;
+    }
+    return table;
+}
+
+//~ @snapshot @pairtable
+static Loco_Yeets
+loco_pair_table_flatten(Arena *arena, Loco_Pair_Table *table)
+{
+    Loco_Yeets yeets = {};
+    if (table == 0) return yeets;
+    yeets.pairs = push_array(arena, Loco_Marker_Pair, table->pairs_count);
+    for (i32 c = 0; c < table->chunks_count; c++)
+    {
+        Loco_Pair_Chunk *chunk = table->chunks[c];
+        block_copy(yeets.pairs + yeets.pairs_count, chunk->pairs, sizeof(Loco_Marker_Pair)*chunk->count);
+        yeets.pairs_count += chunk->count;
+    }
+    return yeets;
+}
+
+//~ @snapshot @pairtable
+// Returns the table without the pairs of buffer, or the table itself if it has none.
+// Takes over the caller's reference, the new table shares the chunks in front of the
+// first pair that was removed.
+static Loco_Pair_Table*
+loco_pair_table_remove_buffer(Arena *arena, Loco_Pair_Table *table, Buffer_ID buffer)
+{
+    bool has_buffer = false;
+    for (i32 c = 0; table != 0 && c < table->chunks_count && !has_buffer; c++)
+    {
+        Loco_Pair_Chunk *chunk = table->chunks[c];
+        for (i32 i = 0; i < chunk->count && !has_buffer; i++) has_buffer = (chunk->pairs[i].buffer == buffer);
+    }
+    if (!has_buffer) return table;
+    
+    Temp_Memory temp = begin_temp(arena);
+    Loco_Yeets yeets = loco_pair_table_flatten(arena, table);
+    i32 kept_count = 0;
+    for (i32 i = 0; i < yeets.pairs_count; i++)
+    {
+        if (yeets.pairs[i].buffer != buffer) yeets.pairs[kept_count++] = yeets.pairs[i];
+    }
+    Loco_Pair_Table *new_table = loco_pair_table_make(yeets.pairs, kept_count, table);
+    loco_pair_table_release(table);
+    end_temp(temp);
+    return new_table;
+}
+
+//--SNAPSHOT-FILE-FORMAT
+
+//~ @persist @snapshot
+// Lays the whole file out in memory, the counts are taken from view->header.
+static String_Const_u8
+loco_snapshot_file_pack(Arena *arena, Loco_Snapshot_File_View *view)
+{
+    Loco_Snapshot_File_Header header = view->header;
+    header.magic = loco_yeet_snapshot_file_magic;
+    header.version = loco_yeet_snapshot_file_version;
+    
+    u64 paths_size = sizeof(Loco_Snapshot_File_Path)*header.path_count;
+    u64 snapshots_size = sizeof(Loco_Snapshot_File_Snapshot)*header.snapshot_count;
+    u64 pairs_size = sizeof(Loco_Snapshot_File_Pair)*header.pair_count;
+    u64 image_size = sizeof(header) + paths_size + snapshots_size + pairs_size + header.string_bytes;
+    u8 *image = push_array(arena, u8, image_size);
+    u8 *at = image;
+    block_copy(at, &header, sizeof(header)); at += sizeof(header);
+    block_copy(at, view->paths, paths_size); at += paths_size;
+    block_copy(at, view->snapshots, snapshots_size); at += snapshots_size;
+    block_copy(at, view->pairs, pairs_size); at += pairs_size;
+    block_copy(at, view->strings, header.string_bytes);
+    return SCu8(image, image_size);
+}
+
+//~ @persist @snapshot
+// Points view into an image read from the snapshot file. Returns false if it isn't a
+// snapshot file of this version or its tables don't fit in it. The offsets inside the
+// records aren't checked here.
+static bool
+loco_snapshot_file_unpack(u8 *image, u64 image_size, Loco_Snapshot_File_View *view)
+{
+    if (image_size < sizeof(Loco_Snapshot_File_Header)) return false;
+    Loco_Snapshot_File_Header *header = (Loco_Snapshot_File_Header*)image;
+    if (header->magic != loco_yeet_snapshot_file_magic || header->version != loco_yeet_snapshot_file_version) return false;
+    
+    u64 paths_size = sizeof(Loco_Snapshot_File_Path)*(u64)header->path_count;
+    u64 snapshots_size = sizeof(Loco_Snapshot_File_Snapshot)*(u64)header->snapshot_count;
+    u64 pairs_size = sizeof(Loco_Snapshot_File_Pair)*(u64)header->pair_count;
+    if (sizeof(*header) + paths_size + snapshots_size + pairs_size + header->string_bytes > image_size) return false;
+    
+    view->header = *header;
+    view->paths = (Loco_Snapshot_File_Path*)(header + 1);
+    view->snapshots = (Loco_Snapshot_File_Snapshot*)((u8*)view->paths + paths_size);
+    view->pairs = (Loco_Snapshot_File_Pair*)((u8*)view->snapshots + snapshots_size);
+    view->strings = (u8*)view->pairs + pairs_size;
+    return true;
+}
+
+//--SESSION-FORMAT
+
+//~ @session @persist
+// Writes a record and its payload at at, returns where the next record goes.
+static u8*
+loco_session_push_record(u8 *at, u32 kind, u32 index, u32 count, void *payload, u64 payload_size)
+{
+    Loco_Session_Record record = {};
+    record.kind = kind;
+    record.index = index;
+    record.count = count;
+    record.size = (u32)((payload_size + 7) & ~7ull);
+    block_copy(at, &record, sizeof(record));
+    at += sizeof(record);
+    block_copy(at, payload, payload_size);
+    block_zero(at + payload_size, record.size - payload_size);
+    return at + record.size;
+}
+
+//~ @session @persist
+// Writes the journal's header at at, returns where the first record goes.
+static u8*
+loco_session_push_header(u8 *at)
+{
+    Loco_Session_File_Header header = {};
+    header.magic = loco_yeet_session_file_magic;
+    header.version = loco_yeet_session_file_version;
+    block_copy(at, &header, sizeof(header));
+    return at + sizeof(header);
+}
+
+//~ @session @persist
+// Replays the records of a journal image in order. A journal cut short, e.g. by a crash
+// during a save, is replayed up to its last whole record, and so is one with a record that
+// doesn't fit the file. Returns false if it isn't a journal of this version.
+static bool
+loco_session_replay(Arena *arena, u8 *image, u64 image_size, Loco_Session_Replay *replay)
+{
+    block_zero_struct(replay);
+    if (image_size < sizeof(Loco_Session_File_Header)) return false;
+    Loco_Session_File_Header *header = (Loco_Session_File_Header*)image;
+    if (header->magic != loco_yeet_session_file_magic || header->version != loco_yeet_session_file_version) return false;
+    
+    i32 chunk_cap = ArrayCount(((Loco_Pair_Chunk*)0)->pairs);
+    // Every pair of the table was written to the journal at some point, a table bigger
+    // than the file could hold is a corrupt record.
+    u64 max_pairs = Min(image_size/sizeof(Loco_Session_Pair) + chunk_cap, (u64)max_i32);
+    i32 pairs_cap = 0;
+    u8 *at = image + sizeof(*header);
+    u8 *end = image + image_size;
+    while (at + sizeof(Loco_Session_Record) <= end)
+    {
+        Loco_Session_Record record = {};
+        block_copy(&record, at, sizeof(record));
+        u8 *payload = at + sizeof(record);
+        if ((u64)record.size > (u64)(end - payload)) break;
+        at = payload + record.size;
+        
+        u64 needed_cap = 0;
+        if (record.kind == Loco_Session_Record_Table) needed_cap = (u64)record.index;
+        if (record.kind == Loco_Session_Record_Chunk)
+        {
+            if (record.count > (u32)chunk_cap || sizeof(Loco_Session_Pair)*(u64)record.count > (u64)record.size) continue;
+            needed_cap = (u64)record.index*(u64)chunk_cap + (u64)record.count;
+        }
+        if (needed_cap > max_pairs) break;
+        if (needed_cap > (u64)pairs_cap)
+        {
+            i32 new_cap = (i32)Min((u64)Max(needed_cap, (u64)pairs_cap*2), max_pairs);
+            Loco_Session_Pair *new_pairs = push_array_zero(arena, Loco_Session_Pair, new_cap);
+            block_copy(new_pairs, replay->pairs, sizeof(Loco_Session_Pair)*pairs_cap);
+            replay->pairs = new_pairs;
+            pairs_cap = new_cap;
+        }
+        
+        switch (record.kind)
+        {
+            case Loco_Session_Record_Table:
+            {
+                replay->pairs_count = (i32)record.index;
+            }break;
+            
+            case Loco_Session_Record_Chunk:
+            {
+                block_copy(replay->pairs + (u64)record.index*chunk_cap, payload, sizeof(Loco_Session_Pair)*record.count);
+            }break;
+            
+            case Loco_Session_Record_Path:
+            {
+                if (record.count > record.size) break;
+                Loco_Session_Path *path = push_array(arena, Loco_Session_Path, 1);
+                path->next = 0;
+                path->path_id = record.index;
+                path->path = SCu8(payload, record.count);
+                if (replay->last_path == 0) replay->first_path = path;
+                else replay->last_path->next = path;
+                replay->last_path = path;
+            }break;
+            
+            case Loco_Session_Record_Active:
+            {
+                if (record.count > record.size) break;
+                replay->active = SCu8(payload, record.count);
+            }break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,452 @@
+// YEET SHEET data check.
+// Round-trips the snapshot file and the session journal and checks the reference counts of
+// the copy-on-write pair tables. 4coder_loco_yeets_data.cpp only needs the base layer, the
+// few parts of it that it uses are stood in for below, so this builds without 4coder:
+// c++ -std=c++11 tests/loco_yeets_data_check.cpp -o loco_yeets_data_check && ./loco_yeets_data_check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+//--BASE-LAYER
+
+#define global static
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t i32;
+typedef int64_t i64;
+typedef i32 Buffer_ID;
+
+#define KB(x) (((u64)(x)) << 10)
+#define ArrayCount(a) (sizeof(a)/sizeof(*(a)))
+#define Min(a,b) (((a)<(b))?(a):(b))
+#define Max(a,b) (((a)>(b))?(a):(b))
+global const i32 max_i32 = 0x7FFFFFFF;
+
+struct Range_i64
+{
+    i64 min;
+    i64 max;
+};
+
+static Range_i64
+Ii64(i64 a, i64 b)
+{
+    Range_i64 range = {Min(a, b), Max(a, b)};
+    return range;
+}
+
+struct String_Const_u8
+{
+    u8 *str;
+    u64 size;
+};
+
+static String_Const_u8
+SCu8(u8 *str, u64 size)
+{
+    String_Const_u8 string = {str, size};
+    return string;
+}
+
+static void
+block_copy(void *dst, const void *src, u64 size)
+{
+    if (size > 0) memmove(dst, src, size);
+}
+
+static bool
+block_match(const void *a, const void *b, u64 size)
+{
+    return size == 0 || memcmp(a, b, size) == 0;
+}
+
+static void
+block_zero(void *dst, u64 size)
+{
+    if (size > 0) memset(dst, 0, size);
+}
+
+#define block_zero_struct(p) block_zero((p), sizeof(*(p)))
+
+// Counts live allocations so the pair table checks can see leaks.
+struct Base_Allocator
+{
+    i64 live_count;
+};
+
+struct Data
+{
+    u8 *data;
+    u64 size;
+};
+
+global Base_Allocator check_allocator = {};
+
+static Base_Allocator*
+get_base_allocator_system(void)
+{
+    return &check_allocator;
+}
+
+static Data
+base_allocate(Base_Allocator *allocator, u64 size)
+{
+    Data data = {(u8*)malloc(size), size};
+    allocator->live_count += 1;
+    return data;
+}
+
+static void
+base_free(Base_Allocator *allocator, void *ptr)
+{
+    if (ptr == 0) return;
+    allocator->live_count -= 1;
+    free(ptr);
+}
+
+// One fixed block is plenty for the checks.
+struct Arena
+{
+    u8 *base;
+    u64 pos;
+    u64 cap;
+};
+
+struct Temp_Memory
+{
+    Arena *arena;
+    u64 pos;
+};
+
+static void*
+arena_push(Arena *arena, u64 size)
+{
+    size = (size + 7) & ~7ull;
+    if (arena->pos + size > arena->cap)
+    {
+        fprintf(stderr, "check arena is full\n");
+        exit(2);
+    }
+    void *result = arena->base + arena->pos;
+    arena->pos += size;
+    return result;
+}
+
+#define push_array(a,T,c) ((T*)arena_push((a), sizeof(T)*(c)))
+#define push_array_zero(a,T,c) ((T*)memset(arena_push((a), sizeof(T)*(c)), 0, sizeof(T)*(c)))
+
+static Temp_Memory
+begin_temp(Arena *arena)
+{
+    Temp_Memory temp = {arena, arena->pos};
+    return temp;
+}
+
+static void
+end_temp(Temp_Memory temp)
+{
+    temp.arena->pos = temp.pos;
+}
+
+#include "../4coder_loco_yeets_data.cpp"
+
+//--CHECKS
+
+global i32 check_failed_count = 0;
+
+#define check(c) check_report((c), #c, __LINE__)
+
+static void
+check_report(bool ok, const char *what, i32 line)
+{
+    if (ok) return;
+    check_failed_count += 1;
+    printf("  FAILED line %d: %s\n", line, what);
+}
+
+static Loco_Marker_Pair
+check_make_pair(i32 i, Buffer_ID buffer)
+{
+    Loco_Marker_Pair pair = {};
+    pair.start_marker_idx = i*2;
+    pair.end_marker_idx = i*2 + 1;
+    pair.yeet_start_marker_idx = i*2;
+    pair.yeet_end_marker_idx = i*2 + 1;
+    pair.buffer = buffer;
+    pair.file_id = (u32)buffer;
+    pair.uid = 1000 + i;
+    pair.dormant_range = Ii64(i*100, i*100 + 40);
+    pair.fingerprint.content_hash = 0xC0FFEE00 + i;
+    pair.fingerprint.content_size = 40;
+    return pair;
+}
+
+//~ @pairtable
+static void
+check_pair_tables(Arena *arena)
+{
+    printf("pair tables\n");
+    Base_Allocator *allocator = get_base_allocator_system();
+    i64 live_before = allocator->live_count;
+    
+    i32 pairs_count = 150;
+    Loco_Marker_Pair *pairs = push_array(arena, Loco_Marker_Pair, pairs_count);
+    for (i32 i = 0; i < pairs_count; i++) pairs[i] = check_make_pair(i, (i % 3 == 0) ? 7 : 8);
+    
+    check(loco_pair_table_make(pairs, 0, 0) == 0);
+    
+    Loco_Pair_Table *a = loco_pair_table_make(pairs, pairs_count, 0);
+    check(a->ref_count == 1);
+    check(a->pairs_count == 150);
+    check(a->chunks_count == 3);
+    check(a->chunks[2]->count == 150 - 128);
+    
+    Loco_Yeets flat = loco_pair_table_flatten(arena, a);
+    check(flat.pairs_count == pairs_count);
+    check(block_match(flat.pairs, pairs, sizeof(Loco_Marker_Pair)*pairs_count));
+    
+    // Changing a pair of the middle chunk shares the other two.
+    pairs[70].uid = 9999;
+    Loco_Pair_Table *b = loco_pair_table_make(pairs, pairs_count, a);
+    check(b->chunks[0] == a->chunks[0]);
+    check(b->chunks[1] != a->chunks[1]);
+    check(b->chunks[2] == a->chunks[2]);
+    check(a->chunks[0]->ref_count == 2);
+    check(a->chunks[1]->ref_count == 1);
+    check(a->chunks[1]->pairs[70 - 64].uid == 1070);
+    
+    check(loco_pair_table_retain(b) == b);
+    check(b->ref_count == 2);
+    loco_pair_table_release(b);
+    check(b->ref_count == 1);
+    
+    // Removing a buffer takes over the reference and keeps the chunks in front of it.
+    Loco_Pair_Table *c = loco_pair_table_remove_buffer(arena, loco_pair_table_retain(b), 42);
+    check(c == b);
+    check(b->ref_count == 2);
+    loco_pair_table_release(c);
+    
+    c = loco_pair_table_remove_buffer(arena, loco_pair_table_retain(b), 7);
+    check(c != b);
+    check(b->ref_count == 1);
+    check(c->pairs_count == 100);
+    Loco_Yeets kept = loco_pair_table_flatten(arena, c);
+    bool only_eights = true;
+    for (i32 i = 0; i < kept.pairs_count; i++) only_eights = only_eights && (kept.pairs[i].buffer == 8);
+    check(only_eights);
+    
+    // Releasing a table keeps the chunks the others still hold.
+    loco_pair_table_release(a);
+    check(b->chunks[0]->ref_count == 1);
+    check(b->chunks[0]->pairs[0].uid == 1000);
+    loco_pair_table_release(b);
+    loco_pair_table_release(c);
+    loco_pair_table_release(0);
+    check(allocator->live_count == live_before);
+}
+
+//~ @persist @snapshot
+static void
+check_snapshot_file(Arena *arena)
+{
+    printf("snapshot file\n");
+    const char *path_text = "C:/code/a.cpp" "C:/code/bb.h";
+    const char *name_text = "first" "second";
+    u32 string_bytes = (u32)(strlen(path_text) + strlen(name_text));
+    u8 *strings = push_array(arena, u8, string_bytes);
+    block_copy(strings, path_text, strlen(path_text));
+    block_copy(strings + strlen(path_text), name_text, strlen(name_text));
+    
+    Loco_Snapshot_File_Path paths[2] = {{0, 13}, {13, 12}};
+    Loco_Snapshot_File_Snapshot snapshots[2] = {{0, 2, 25, 5}, {2, 1, 30, 6}};
+    Loco_Snapshot_File_Pair pairs[3] = {};
+    for (u32 i = 0; i < 3; i++)
+    {
+        pairs[i].uid = 500 + i;
+        pairs[i].fingerprint.head_hash = 0xABCD0000 + i;
+        pairs[i].fingerprint.line_count = (i32)i + 1;
+        pairs[i].start = 10*i;
+        pairs[i].end = 10*i + 5;
+        pairs[i].path_index = i % 2;
+        pairs[i].flags = i;
+    }
+    
+    Loco_Snapshot_File_View view = {};
+    view.header.path_count = 2;
+    view.header.snapshot_count = 2;
+    view.header.pair_count = 3;
+    view.header.string_bytes = string_bytes;
+    view.paths = paths;
+    view.snapshots = snapshots;
+    view.pairs = pairs;
+    view.strings = strings;
+    String_Const_u8 image = loco_snapshot_file_pack(arena, &view);
+    check(image.size == sizeof(Loco_Snapshot_File_Header) + sizeof(paths) + sizeof(snapshots) + sizeof(pairs) + string_bytes);
+    
+    Loco_Snapshot_File_View read = {};
+    check(loco_snapshot_file_unpack(image.str, image.size, &read));
+    check(read.header.magic == loco_yeet_snapshot_file_magic);
+    check(read.header.version == loco_yeet_snapshot_file_version);
+    check(read.header.path_count == 2 && read.header.snapshot_count == 2 && read.header.pair_count == 3);
+    check(read.header.string_bytes == string_bytes);
+    check(block_match(read.paths, paths, sizeof(paths)));
+    check(block_match(read.snapshots, snapshots, sizeof(snapshots)));
+    check(block_match(read.pairs, pairs, sizeof(pairs)));
+    check(block_match(read.strings, strings, string_bytes));
+    check(block_match(read.strings + read.paths[1].offset, "C:/code/bb.h", 12));
+    check(block_match(read.strings + read.snapshots[1].name_offset, "second", 6));
+    
+    // A cut short file, a foreign one and a newer version are all turned down.
+    check(!loco_snapshot_file_unpack(image.str, image.size - 1, &read));
+    check(!loco_snapshot_file_unpack(image.str, sizeof(Loco_Snapshot_File_Header) - 1, &read));
+    u8 *bad = push_array(arena, u8, image.size);
+    block_copy(bad, image.str, image.size);
+    ((Loco_Snapshot_File_Header*)bad)->magic ^= 1;
+    check(!loco_snapshot_file_unpack(bad, image.size, &read));
+    block_copy(bad, image.str, image.size);
+    ((Loco_Snapshot_File_Header*)bad)->version += 1;
+    check(!loco_snapshot_file_unpack(bad, image.size, &read));
+    block_copy(bad, image.str, image.size);
+    ((Loco_Snapshot_File_Header*)bad)->pair_count = 0xFFFFFFFF;
+    check(!loco_snapshot_file_unpack(bad, image.size, &read));
+}
+
+static Loco_Session_Pair
+check_make_session_pair(i32 i, u32 path_id)
+{
+    Loco_Session_Pair pair = {};
+    pair.record.uid = 2000 + i;
+    pair.record.fingerprint.content_hash = 0xFEED0000 + i;
+    pair.record.start = i;
+    pair.record.end = i + 3;
+    pair.record.path_index = path_id;
+    pair.sheet_key = i;
+    return pair;
+}
+
+static bool
+check_session_pair(Loco_Session_Pair *pair, i32 i, u32 path_id)
+{
+    Loco_Session_Pair expected = check_make_session_pair(i, path_id);
+    return block_match(pair, &expected, sizeof(expected));
+}
+
+//~ @session @persist
+static void
+check_session_journal(Arena *arena)
+{
+    printf("session journal\n");
+    i32 chunk_cap = ArrayCount(((Loco_Pair_Chunk*)0)->pairs);
+    i32 pairs_count = 100;
+    Loco_Session_Pair *pairs = push_array(arena, Loco_Session_Pair, pairs_count);
+    for (i32 i = 0; i < pairs_count; i++) pairs[i] = check_make_session_pair(i, 1 + (i % 2));
+    
+    u8 *image = push_array_zero(arena, u8, KB(64));
+    u8 *at = loco_session_push_header(image);
+    // A compacted save: the table, the paths and every chunk.
+    at = loco_session_push_record(at, Loco_Session_Record_Table, (u32)pairs_count, 0, 0, 0);
+    at = loco_session_push_record(at, Loco_Session_Record_Path, 1, 5, (void*)"a.cpp", 5);
+    at = loco_session_push_record(at, Loco_Session_Record_Path, 2, 4, (void*)"b.hh", 4);
+    at = loco_session_push_record(at, Loco_Session_Record_Chunk, 0, (u32)chunk_cap, pairs, sizeof(Loco_Session_Pair)*chunk_cap);
+    at = loco_session_push_record(at, Loco_Session_Record_Chunk, 1, (u32)(pairs_count - chunk_cap),
+                                  pairs + chunk_cap, sizeof(Loco_Session_Pair)*(pairs_count - chunk_cap));
+    at = loco_session_push_record(at, Loco_Session_Record_Active, 0, 3, (void*)"one", 3);
+    u64 compacted_size = (u64)(at - image);
+    check(compacted_size % 8 == 0);
+    
+    Loco_Session_Replay replay = {};
+    check(loco_session_replay(arena, image, compacted_size, &replay));
+    check(replay.pairs_count == pairs_count);
+    bool all_match = true;
+    for (i32 i = 0; i < pairs_count; i++) all_match = all_match && check_session_pair(&replay.pairs[i], i, 1 + (i % 2));
+    check(all_match);
+    check(replay.first_path != 0 && replay.first_path->path_id == 1);
+    check(replay.first_path->next == replay.last_path && replay.last_path->path_id == 2);
+    check(block_match(replay.last_path->path.str, "b.hh", 4) && replay.last_path->path.size == 4);
+    check(replay.active.size == 3 && block_match(replay.active.str, "one", 3));
+    
+    // An appended save: the table shrank, the second chunk was rewritten and a path moved.
+    i32 new_count = 80;
+    for (i32 i = chunk_cap; i < new_count; i++) pairs[i] = check_make_session_pair(i + 500, 3);
+    at = loco_session_push_record(at, Loco_Session_Record_Table, (u32)new_count, 0, 0, 0);
+    at = loco_session_push_record(at, Loco_Session_Record_Path, 3, 6, (void*)"cc.cpp", 6);
+    at = loco_session_push_record(at, Loco_Session_Record_Chunk, 1, (u32)(new_count - chunk_cap),
+                                  pairs + chunk_cap, sizeof(Loco_Session_Pair)*(new_count - chunk_cap));
+    at = loco_session_push_record(at, Loco_Session_Record_Active, 0, 0, 0, 0);
+    u64 appended_size = (u64)(at - image);
+    
+    check(loco_session_replay(arena, image, appended_size, &replay));
+    check(replay.pairs_count == new_count);
+    all_match = true;
+    for (i32 i = 0; i < chunk_cap; i++) all_match = all_match && check_session_pair(&replay.pairs[i], i, 1 + (i % 2));
+    for (i32 i = chunk_cap; i < new_count; i++) all_match = all_match && check_session_pair(&replay.pairs[i], i + 500, 3);
+    check(all_match);
+    check(replay.last_path->path_id == 3);
+    check(replay.active.size == 0);
+    
+    // A save cut short replays up to the last whole record.
+    check(loco_session_replay(arena, image, appended_size - 1, &replay));
+    check(replay.pairs_count == new_count);
+    check(replay.active.size == 3);
+    check(loco_session_replay(arena, image, compacted_size + 3, &replay));
+    check(replay.pairs_count == pairs_count);
+    check(check_session_pair(&replay.pairs[pairs_count - 1], pairs_count - 1, 2));
+    
+    // Not a journal, or not this version.
+    check(!loco_session_replay(arena, image, sizeof(Loco_Session_File_Header) - 1, &replay));
+    u8 *bad = push_array(arena, u8, appended_size);
+    block_copy(bad, image, appended_size);
+    ((Loco_Session_File_Header*)bad)->magic ^= 1;
+    check(!loco_session_replay(arena, bad, appended_size, &replay));
+    block_copy(bad, image, appended_size);
+    ((Loco_Session_File_Header*)bad)->version += 1;
+    check(!loco_session_replay(arena, bad, appended_size, &replay));
+    
+    // Records that claim more than the file could hold stop the replay instead of
+    // overflowing: a huge chunk index, a huge table and a payload past the end.
+    u8 *tail = bad + sizeof(Loco_Session_File_Header);
+    block_copy(bad, image, sizeof(Loco_Session_File_Header));
+    u8 *bad_end = loco_session_push_record(tail, Loco_Session_Record_Chunk, 0xFFFFFFFF, 1, pairs, sizeof(Loco_Session_Pair));
+    check(loco_session_replay(arena, bad, (u64)(bad_end - bad), &replay));
+    check(replay.pairs_count == 0);
+    bad_end = loco_session_push_record(tail, Loco_Session_Record_Table, 0x7FFFFFFF, 0, 0, 0);
+    check(loco_session_replay(arena, bad, (u64)(bad_end - bad), &replay));
+    check(replay.pairs_count == 0);
+    bad_end = loco_session_push_record(tail, Loco_Session_Record_Active, 0, 3, (void*)"two", 3);
+    ((Loco_Session_Record*)tail)->size = 0xFFFFFFF0;
+    check(loco_session_replay(arena, bad, (u64)(bad_end - bad), &replay));
+    check(replay.active.size == 0);
+    // A chunk with more pairs than a chunk holds is skipped, the records after it still count.
+    bad_end = loco_session_push_record(tail, Loco_Session_Record_Chunk, 0, (u32)chunk_cap + 1, pairs, sizeof(Loco_Session_Pair));
+    bad_end = loco_session_push_record(bad_end, Loco_Session_Record_Active, 0, 3, (void*)"two", 3);
+    check(loco_session_replay(arena, bad, (u64)(bad_end - bad), &replay));
+    check(replay.pairs_count == 0);
+    check(replay.active.size == 3 && block_match(replay.active.str, "two", 3));
+}
+
+int
+main(void)
+{
+    Arena arena = {};
+    arena.cap = 16 << 20;
+    arena.base = (u8*)malloc(arena.cap);
+    
+    check_pair_tables(&arena);
+    arena.pos = 0;
+    check_snapshot_file(&arena);
+    arena.pos = 0;
+    check_session_journal(&arena);
+    
+    free(arena.base);
+    if (check_failed_count > 0)
+    {
+        printf("%d checks FAILED\n", check_failed_count);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}